@@ -0,0 +1,878 @@
+#include "nozip.h"
+#include "stb_inflate.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define rdtsc() __rdtsc()
+#else
+#define rdtsc() 0
+#endif
+
+struct timer {
+    double seconds;
+    uint64_t cycles;
+};
+
+static struct timer timer_start(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (struct timer){ts.tv_sec + ts.tv_nsec * 1e-9, rdtsc()};
+}
+
+// results are printed as one JSON array, cycles_per_byte is null where there's no cycle counter
+static int num_results;
+
+static void report(const char *group, const char *name, size_t count, uint64_t bytes, struct timer start) {
+    struct timer end = timer_start();
+    double seconds = end.seconds - start.seconds;
+    uint64_t cycles = end.cycles - start.cycles;
+    printf("%s\n  {\"group\": \"%s\", \"name\": \"%s\", \"count\": %zu, \"bytes\": %" PRIu64 ", \"seconds\": %.9f, "
+           "\"ns_per_item\": %.3f, \"mb_per_s\": %.3f, \"cycles_per_byte\": ",
+           num_results++ ? "," : "[", group, name, count, bytes, seconds,
+           count ? seconds * 1e9 / count : 0.0, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+    if (cycles && bytes)
+        printf("%.3f}", (double)cycles / bytes);
+    else
+        printf("null}");
+}
+
+// deterministic generator, same corpus on every run
+static uint64_t rng_state = 0x9E3779B97F4A7C15;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 32);
+}
+
+// minimal archive writer, zip64 end of central directory when needed
+struct writer {
+    FILE *fp;
+    uint8_t *cdr;
+    size_t cdr_size;
+    size_t cdr_capacity;
+    uint64_t num_entries;
+};
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static uint8_t *put64(uint8_t *p, uint64_t v) {
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static void writer_add(struct writer *w, const char *filename, uint16_t method, uint32_t crc_32,
+                       const void *data, uint32_t compressed_size, uint32_t uncompressed_size) {
+    uint16_t length = strlen(filename);
+    uint64_t offset = ftello(w->fp);
+
+    uint8_t lfh[30], *p = lfh;
+    p = put32(p, 0x04034B50);
+    p = put16(p, 20);
+    p = put16(p, 0);
+    p = put16(p, method);
+    p = put32(p, 0x00210000);
+    p = put32(p, crc_32);
+    p = put32(p, compressed_size);
+    p = put32(p, uncompressed_size);
+    p = put16(p, length);
+    p = put16(p, 0);
+    fwrite(lfh, sizeof(lfh), 1, w->fp);
+    fwrite(filename, length, 1, w->fp);
+    fwrite(data, compressed_size, 1, w->fp);
+
+    if (w->cdr_size + 46 + 12 + length > w->cdr_capacity) {
+        w->cdr_capacity = (w->cdr_capacity + 46 + 12 + length) * 2;
+        w->cdr = (uint8_t *)realloc(w->cdr, w->cdr_capacity);
+    }
+    int zip64 = offset >= UINT32_MAX;
+    p = w->cdr + w->cdr_size;
+    p = put32(p, 0x02014B50);
+    p = put16(p, 20);
+    p = put16(p, 20);
+    p = put16(p, 0);
+    p = put16(p, method);
+    p = put32(p, 0x00210000);
+    p = put32(p, crc_32);
+    p = put32(p, compressed_size);
+    p = put32(p, uncompressed_size);
+    p = put16(p, length);
+    p = put16(p, zip64 ? 12 : 0);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put32(p, 0);
+    p = put32(p, zip64 ? UINT32_MAX : offset);
+    memcpy(p, filename, length);
+    p += length;
+    if (zip64) {
+        p = put16(p, 0x0001);
+        p = put16(p, 8);
+        p = put64(p, offset);
+    }
+    w->cdr_size = p - w->cdr;
+    ++w->num_entries;
+}
+
+static void writer_finish(struct writer *w) {
+    uint64_t cdr_offset = ftello(w->fp);
+    fwrite(w->cdr, w->cdr_size, 1, w->fp);
+
+    int zip64 = w->num_entries >= UINT16_MAX || cdr_offset >= UINT32_MAX || w->cdr_size >= UINT32_MAX;
+    uint8_t buf[56 + 20 + 22], *p = buf;
+    if (zip64) {
+        uint64_t eocdr64_offset = ftello(w->fp);
+        p = put32(p, 0x06064B50);
+        p = put64(p, 44);
+        p = put16(p, 45);
+        p = put16(p, 45);
+        p = put32(p, 0);
+        p = put32(p, 0);
+        p = put64(p, w->num_entries);
+        p = put64(p, w->num_entries);
+        p = put64(p, w->cdr_size);
+        p = put64(p, cdr_offset);
+        p = put32(p, 0x07064B50);
+        p = put32(p, 0);
+        p = put64(p, eocdr64_offset);
+        p = put32(p, 1);
+    }
+    p = put32(p, 0x06054B50);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, zip64 ? UINT16_MAX : w->num_entries);
+    p = put16(p, zip64 ? UINT16_MAX : w->num_entries);
+    p = put32(p, zip64 ? UINT32_MAX : w->cdr_size);
+    p = put32(p, zip64 ? UINT32_MAX : cdr_offset);
+    p = put16(p, 0);
+    fwrite(buf, p - buf, 1, w->fp);
+    fflush(w->fp);
+
+    free(w->cdr);
+    w->cdr = NULL;
+}
+
+// archive of many small stored files spread over a directory tree
+static FILE *make_many_small(size_t num_entries, uint32_t max_size) {
+    struct writer w = {.fp = tmpfile()};
+    if (!w.fp)
+        return NULL;
+    char data[256], filename[64];
+    rng_state = 0x9E3779B97F4A7C15;
+    for (size_t i = 0; i < num_entries; ++i) {
+        uint32_t size = max_size ? rng() % max_size % sizeof(data) : 0;
+        for (uint32_t k = 0; k < size; ++k)
+            data[k] = 'a' + rng() % 26;
+        snprintf(filename, sizeof(filename), "dir%u/sub%u/file%zu.txt", rng() % 16, rng() % 64, i);
+        writer_add(&w, filename, 0, zip_crc32(0, data, size), data, size, size);
+    }
+    writer_finish(&w);
+    return w.fp;
+}
+
+enum corpus { CORPUS_TEXT, CORPUS_JSON, CORPUS_BINARY, CORPUS_RANDOM, CORPUS_RUNS, NUM_CORPUS };
+
+static const char *corpus_names[NUM_CORPUS] = {"text", "json", "binary", "random", "runs"};
+
+static void make_corpus(uint8_t *data, size_t size, int kind, uint64_t seed) {
+    static const char *words[] = {"the", "of", "and", "archive", "entry", "central", "directory", "header", "inflate",
+                                  "huffman", "window", "stream", "a", "to", "in", "is", "data", "offset", "size", "file"};
+    const size_t num_words = sizeof(words) / sizeof(*words);
+    char record[128];
+    rng_state = seed | 1;
+    for (size_t i = 0; i < size;) {
+        size_t n = 0;
+        switch (kind) {
+        case CORPUS_TEXT:
+            // skewed word frequencies and occasional line breaks
+            n = snprintf(record, sizeof(record), "%s%c", words[rng() % num_words % (1 + rng() % num_words)], rng() % 12 ? ' ' : '\n');
+            break;
+        case CORPUS_JSON:
+            n = snprintf(record, sizeof(record), "{\"id\": %u, \"name\": \"%s\", \"tags\": [\"%s\", \"%s\"], \"value\": %u.%03u},\n",
+                         (unsigned)(i / 64), words[rng() % num_words], words[rng() % num_words], words[rng() % num_words],
+                         rng() % 1000, rng() % 1000);
+            break;
+        case CORPUS_BINARY: {
+            // table of records with counters, small ints and floats
+            uint32_t counter = i / 16;
+            uint16_t small = rng() % 64;
+            uint16_t flags = rng() % 4 ? 0 : 0x8000;
+            float value = (float)(rng() % 10000) / 100;
+            memcpy(record, &counter, 4);
+            memcpy(record + 4, &small, 2);
+            memcpy(record + 6, &flags, 2);
+            memcpy(record + 8, &value, 4);
+            memset(record + 12, 0, 4);
+            n = 16;
+            break;
+        }
+        case CORPUS_RANDOM:
+            for (; n + 4 <= sizeof(record); n += 4) {
+                uint32_t r = rng();
+                memcpy(record + n, &r, 4);
+            }
+            break;
+        case CORPUS_RUNS: {
+            size_t length = 1 + rng() % 4096;
+            memset(data + i, rng() & 0xFF, length < size - i ? length : size - i);
+            i += length;
+            continue;
+        }
+        }
+        memcpy(data + i, record, n < size - i ? n : size - i);
+        i += n;
+    }
+}
+
+static uint8_t *deflate_raw(const uint8_t *data, size_t size, size_t *compressed_size) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+    size_t bound = deflateBound(&stream, size);
+    uint8_t *out = (uint8_t *)malloc(bound);
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = size;
+    stream.next_out = out;
+    stream.avail_out = bound;
+    if (!out || deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        free(out);
+        out = NULL;
+    }
+    *compressed_size = stream.total_out;
+    deflateEnd(&stream);
+    return out;
+}
+
+// flush target for stb_inflate, copies output to dst unless it's NULL
+struct sink {
+    uint8_t *dst;
+    size_t size;
+};
+
+static int flush_sink(struct stbi__stream *stream) {
+    struct sink *sink = (struct sink *)stream->cookie_out;
+    size_t n = stream->next_out - stream->start_out;
+    if (sink->dst)
+        memcpy(sink->dst + sink->size, stream->start_out, n);
+    sink->size += n;
+    stream->next_out = stream->start_out;
+    return 0;
+}
+
+static size_t stb_inflate_memory(const uint8_t *in, size_t in_size, uint8_t *dst) {
+    struct stbi__stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    stream.start_in = stream.next_in = in;
+    stream.end_in = in + in_size;
+    stream.refill = refill_zeros;
+
+    uint8_t window[1 << 15];
+    struct sink sink = {dst, 0};
+    stream.start_out = stream.next_out = window;
+    stream.end_out = window + sizeof(window);
+    stream.cookie_out = &sink;
+    stream.flush = flush_sink;
+
+    return stb_inflate(&stream) ? sink.size : 0;
+}
+
+static size_t stb_inflate_stdio(FILE *fp) {
+    struct stbi__stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    uint8_t buffer[BUFSIZ];
+    stream.start_in = buffer;
+    stream.end_in = stream.next_in = buffer + sizeof(buffer);
+    stream.cookie_in = fp;
+    stream.refill = refill_stdio;
+
+    uint8_t window[1 << 15];
+    struct sink sink = {NULL, 0};
+    stream.start_out = stream.next_out = window;
+    stream.end_out = window + sizeof(window);
+    stream.cookie_out = &sink;
+    stream.flush = flush_sink;
+
+    return stb_inflate(&stream) ? sink.size : 0;
+}
+
+static size_t zlib_inflate_memory(const uint8_t *in, size_t in_size, uint8_t *dst) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return 0;
+
+    uint8_t window[1 << 15];
+    stream.next_in = (Bytef *)in;
+    stream.avail_in = in_size;
+    int ret;
+    do {
+        stream.next_out = window;
+        stream.avail_out = sizeof(window);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        if (dst)
+            memcpy(dst + stream.total_out - (sizeof(window) - stream.avail_out), window, sizeof(window) - stream.avail_out);
+    } while (ret == Z_OK);
+    inflateEnd(&stream);
+    return ret == Z_STREAM_END ? stream.total_out : 0;
+}
+
+// stb_inflate versus zlib on the same raw deflate streams
+static void bench_inflate(size_t size, int repeat) {
+    uint8_t *data = (uint8_t *)malloc(size);
+    uint8_t *check = (uint8_t *)malloc(size);
+    for (int kind = 0; kind < NUM_CORPUS; ++kind) {
+        make_corpus(data, size, kind, 1 + kind);
+        size_t compressed_size = 0;
+        uint8_t *compressed = deflate_raw(data, size, &compressed_size);
+        if (!(compressed &&
+              stb_inflate_memory(compressed, compressed_size, check) == size && memcmp(data, check, size) == 0 &&
+              zlib_inflate_memory(compressed, compressed_size, check) == size && memcmp(data, check, size) == 0)) {
+            fprintf(stderr, "error: %s: inflate mismatch\n", corpus_names[kind]);
+            exit(EXIT_FAILURE);
+        }
+
+        char name[64];
+        struct timer t = timer_start();
+        for (int r = 0; r < repeat; ++r)
+            stb_inflate_memory(compressed, compressed_size, NULL);
+        snprintf(name, sizeof(name), "stb_inflate_%s", corpus_names[kind]);
+        report("inflate", name, repeat, (uint64_t)size * repeat, t);
+
+        t = timer_start();
+        for (int r = 0; r < repeat; ++r)
+            zlib_inflate_memory(compressed, compressed_size, NULL);
+        snprintf(name, sizeof(name), "zlib_%s", corpus_names[kind]);
+        report("inflate", name, repeat, (uint64_t)size * repeat, t);
+
+        free(compressed);
+    }
+    free(check);
+    free(data);
+}
+
+static int count_entry(const struct zip_entry *entry, void *user) {
+    return 0;
+}
+
+// a loader or lookup that stops finding entries would only look faster
+static void check_count(const char *name, size_t count, size_t expected) {
+    if (count != expected) {
+        fprintf(stderr, "error: %s: got %zu of %zu\n", name, count, expected);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// open time against entry count for every way of loading the central directory
+static void bench_open(size_t num_entries) {
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char index_path[] = "/tmp/nozip_bench_XXXXXX";
+    int fd = mkstemp(index_path);
+    if (fd == -1) {
+        perror(index_path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    for (size_t n = num_entries / 100; n <= num_entries; n *= 10) {
+        FILE *fp = make_many_small(n, 0);
+        char name[64];
+        struct timer t;
+        size_t count;
+
+        struct zip_entry *entries = NULL;
+        t = timer_start();
+        count = zip_read(&entries, fp);
+        snprintf(name, sizeof(name), "zip_read_%zu", n);
+        report("open", name, count, 0, t);
+        check_count(name, count, n);
+        free(entries);
+
+        // caller owned arena, sized once and reused across opens
+        size_t size = zip_read_size(fp);
+        entries = (struct zip_entry *)malloc(size ? size : 1);
+        t = timer_start();
+        count = entries ? zip_read_into(entries, size, fp) : 0;
+        snprintf(name, sizeof(name), "zip_read_into_%zu", n);
+        report("open", name, count, 0, t);
+        check_count(name, count, n);
+        free(entries);
+
+        t = timer_start();
+        count = zip_read_mt(&entries, fp, num_threads, NULL);
+        snprintf(name, sizeof(name), "zip_read_mt_%zu", n);
+        report("open", name, count, 0, t);
+        check_count(name, count, n);
+        free(entries);
+
+        t = timer_start();
+        count = zip_iterate(fp, count_entry, NULL, NULL);
+        count = count == (size_t)-1 ? 0 : count;
+        snprintf(name, sizeof(name), "zip_iterate_%zu", n);
+        report("open", name, count, 0, t);
+        check_count(name, count, n);
+
+        struct zip_table table;
+        t = timer_start();
+        count = zip_read_table(&table, fp, NULL) ? 0 : table.num_entries;
+        snprintf(name, sizeof(name), "zip_read_table_%zu", n);
+        report("open", name, count, 0, t);
+        check_count(name, count, n);
+        if (count)
+            zip_table_free(&table);
+
+        zip_index_write(fp, index_path, NULL);
+        t = timer_start();
+        const struct zip_index *index = zip_index_open(fp, index_path);
+        snprintf(name, sizeof(name), "zip_index_open_%zu", n);
+        report("open", name, index ? index->num_entries : 0, 0, t);
+        check_count(name, index ? index->num_entries : 0, n);
+        zip_index_close(index);
+
+        fclose(fp);
+        if (n == 0)
+            break;
+    }
+    unlink(index_path);
+}
+
+// lookup latency by filename over flat array, directory tree and index
+static void bench_lookup(size_t num_entries, size_t num_lookups) {
+    FILE *fp = make_many_small(num_entries, 0);
+    struct zip_entry *entries = NULL;
+    size_t n = fp ? zip_read(&entries, fp) : 0;
+    char index_path[] = "/tmp/nozip_bench_XXXXXX";
+    int fd = mkstemp(index_path);
+    if (fd != -1)
+        close(fd);
+    if (!(n && fd != -1 && zip_index_write(fp, index_path, NULL) == 0)) {
+        fprintf(stderr, "error: can't read generated archive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const char **names = (const char **)malloc(num_lookups * sizeof(*names));
+    rng_state = 0x2545F4914F6CDD1D;
+    for (size_t i = 0; i < num_lookups; ++i)
+        names[i] = entries[rng() % n].filename;
+
+    // every name is in the archive, so each lookup has to hit
+    volatile size_t found = 0;
+    struct timer t;
+
+    // linear search is too slow for the full lookup count
+    size_t num_linear = num_lookups < 1000 ? num_lookups : 1000;
+    t = timer_start();
+    for (size_t i = 0; i < num_linear; ++i)
+        for (size_t k = 0; k < n; ++k)
+            if (!strcmp(entries[k].filename, names[i])) {
+                ++found;
+                break;
+            }
+    report("lookup", "linear", num_linear, 0, t);
+    check_count("linear", found, num_linear);
+
+    struct zip_dir dir;
+    t = timer_start();
+    int err = zip_dir_build(&dir, entries, n, NULL);
+    report("lookup", "zip_dir_build", n, 0, t);
+    if (err) {
+        fprintf(stderr, "error: can't build directory tree\n");
+        exit(EXIT_FAILURE);
+    }
+
+    found = 0;
+    t = timer_start();
+    for (size_t i = 0; i < num_lookups; ++i)
+        found += zip_stat(&dir, names[i]) != NULL;
+    report("lookup", "zip_stat", num_lookups, 0, t);
+    check_count("zip_stat", found, num_lookups);
+
+    const struct zip_index *index = zip_index_open(fp, index_path);
+    check_count("zip_index_open", index ? index->num_entries : 0, n);
+    found = 0;
+    t = timer_start();
+    for (size_t i = 0; i < num_lookups; ++i)
+        found += zip_index_find(index, names[i]) != NULL;
+    report("lookup", "zip_index_find", num_lookups, 0, t);
+    check_count("zip_index_find", found, num_lookups);
+
+    zip_index_close(index);
+    unlink(index_path);
+    zip_dir_free(&dir);
+    free(names);
+    free(entries);
+    fclose(fp);
+}
+
+// patch archive of empty files under its own prefix, none of its paths are in the base
+static FILE *make_patch(int layer, size_t num_entries) {
+    struct writer w = {.fp = tmpfile()};
+    if (!w.fp)
+        return NULL;
+    char filename[64];
+    for (size_t i = 0; i < num_entries; ++i) {
+        snprintf(filename, sizeof(filename), "patch%d/file%zu.txt", layer, i);
+        writer_add(&w, filename, 0, 0, "", 0, 0);
+    }
+    writer_finish(&w);
+    return w.fp;
+}
+
+// base archive with patch layers on top, lookup of base paths through overlay versus searching each layer newest first
+static void bench_overlay(size_t num_entries, size_t num_lookups) {
+    enum { MAX_LAYERS = 16 };
+    FILE *fp[MAX_LAYERS];
+    struct zip_entry *entries[MAX_LAYERS];
+    size_t num[MAX_LAYERS];
+    for (int l = 0; l < MAX_LAYERS; ++l) {
+        fp[l] = l ? make_patch(l, num_entries) : make_many_small(num_entries, 0);
+        num[l] = fp[l] ? zip_read(entries + l, fp[l]) : 0;
+        if (!num[l]) {
+            fprintf(stderr, "error: can't read generated archive\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const char **names = (const char **)malloc(num_lookups * sizeof(*names));
+    rng_state = 0x2545F4914F6CDD1D;
+    for (size_t i = 0; i < num_lookups; ++i)
+        names[i] = entries[0][rng() % num[0]].filename;
+
+    volatile size_t found = 0;
+    char name[64];
+    for (int num_layers = 1; num_layers <= MAX_LAYERS; num_layers *= 4) {
+        struct zip_overlay *overlay = zip_overlay_create(NULL);
+        size_t total = 0, pushed = 0;
+        struct timer t = timer_start();
+        int top = -1;
+        for (int l = 0; l < num_layers; ++l) {
+            top = zip_overlay_push(overlay, fp[l]);
+            pushed += top < 0 ? 0 : num[l];
+            total += num[l];
+        }
+        snprintf(name, sizeof(name), "zip_overlay_push_%d", num_layers);
+        report("overlay", name, total, 0, t);
+        check_count(name, pushed, total);
+
+        found = 0;
+        t = timer_start();
+        for (size_t i = 0; i < num_lookups; ++i)
+            found += zip_overlay_find(overlay, names[i], NULL) != NULL;
+        snprintf(name, sizeof(name), "zip_overlay_find_%d", num_layers);
+        report("overlay", name, num_lookups, 0, t);
+        check_count(name, found, num_lookups);
+
+        // base paths miss in every patch, so each lookup scans all patches before the hit in base
+        size_t num_linear = num_lookups < 200 ? num_lookups : 200;
+        found = 0;
+        t = timer_start();
+        for (size_t i = 0; i < num_linear; ++i) {
+            int hit = 0;
+            for (int l = num_layers - 1; l >= 0 && !hit; --l)
+                for (size_t k = 0; k < num[l] && !hit; ++k)
+                    hit = !strcmp(entries[l][k].filename, names[i]);
+            found += hit;
+        }
+        snprintf(name, sizeof(name), "linear_%d", num_layers);
+        report("overlay", name, num_linear, 0, t);
+        check_count(name, found, num_linear);
+
+        t = timer_start();
+        zip_overlay_remove(overlay, top);
+        snprintf(name, sizeof(name), "zip_overlay_remove_%d", num_layers);
+        report("overlay", name, num[num_layers - 1], 0, t);
+        zip_overlay_destroy(overlay);
+    }
+
+    free(names);
+    for (int l = 0; l < MAX_LAYERS; ++l) {
+        free(entries[l]);
+        fclose(fp[l]);
+    }
+}
+
+// deflated archive of num_files files cycling through corpus kinds
+static FILE *make_deflated(size_t num_files, size_t file_size) {
+    struct writer w = {.fp = tmpfile()};
+    uint8_t *data = (uint8_t *)malloc(file_size);
+    if (!(w.fp && data))
+        return NULL;
+    char filename[64];
+    for (size_t i = 0; i < num_files; ++i) {
+        int kind = i % NUM_CORPUS;
+        make_corpus(data, file_size, kind, i + 1);
+        size_t compressed_size = 0;
+        uint8_t *compressed = deflate_raw(data, file_size, &compressed_size);
+        if (!compressed)
+            return NULL;
+        snprintf(filename, sizeof(filename), "%s/%zu.dat", corpus_names[kind], i);
+        writer_add(&w, filename, 8, zip_crc32(0, data, file_size), compressed, compressed_size, file_size);
+        free(compressed);
+    }
+    writer_finish(&w);
+    free(data);
+    return w.fp;
+}
+
+// extraction throughput for whole-entry buffers versus streaming reads
+static void bench_extract(const char *archive, size_t num_files, size_t file_size) {
+    FILE *fp = make_deflated(num_files, file_size);
+    struct zip_entry *entries = NULL;
+    size_t n = fp ? zip_read(&entries, fp) : 0;
+    uint8_t *buf = (uint8_t *)malloc(file_size * 2);
+    if (!(n == num_files && buf)) {
+        fprintf(stderr, "error: can't read generated archive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; ++i)
+        total += entries[i].uncompressed_size;
+
+    char name[64];
+    struct timer t = timer_start();
+    for (size_t i = 0; i < n; ++i)
+        if (zip_seek(fp, entries + i) == 0 && fread(buf, entries[i].compressed_size, 1, fp))
+            stb_inflate_memory(buf, entries[i].compressed_size, NULL);
+    snprintf(name, sizeof(name), "%s_stb_inflate_memory", archive);
+    report("extract", name, n, total, t);
+
+    t = timer_start();
+    for (size_t i = 0; i < n; ++i)
+        if (zip_seek(fp, entries + i) == 0)
+            stb_inflate_stdio(fp);
+    snprintf(name, sizeof(name), "%s_stb_inflate_stdio", archive);
+    report("extract", name, n, total, t);
+
+    t = timer_start();
+    for (size_t i = 0; i < n; ++i)
+        if (zip_seek(fp, entries + i) == 0 && fread(buf, entries[i].compressed_size, 1, fp))
+            zlib_inflate_memory(buf, entries[i].compressed_size, NULL);
+    snprintf(name, sizeof(name), "%s_zlib_memory", archive);
+    report("extract", name, n, total, t);
+
+    // full verification including crc, sequential reads in archive order on every core
+    struct zip_table table;
+    struct zip_test_result *results = (struct zip_test_result *)malloc(n * sizeof(*results));
+    if (results && zip_read_table(&table, fp, NULL) == 0) {
+        t = timer_start();
+        long failed = zip_test(fp, &table, results, sysconf(_SC_NPROCESSORS_ONLN), NULL);
+        snprintf(name, sizeof(name), "%s_zip_test", archive);
+        report("extract", name, failed == 0 ? n : 0, total, t);
+        zip_table_free(&table);
+    }
+
+    free(results);
+    free(buf);
+    free(entries);
+    fclose(fp);
+}
+
+// random range reads of hot deflated entries through zip_fread, with cache off every read inflates from entry start
+static void bench_cache(size_t num_reads, size_t read_size) {
+    FILE *fp = make_deflated(4, 8 << 20);
+    struct zip_entry *entries = NULL;
+    size_t n = fp ? zip_read(&entries, fp) : 0;
+    uint8_t *buf = (uint8_t *)malloc(read_size);
+    if (!(n && buf)) {
+        fprintf(stderr, "error: can't read generated archive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct zip_pool *pool = zip_pool_create(ZIP_DECODER_SIZE, 1, NULL);
+    static const struct {
+        const char *name;
+        size_t limit;
+        int pooled;
+    } configs[] = {{"zip_fread_uncached", 0, 0}, {"zip_fread_uncached_pool", 0, 1}, {"zip_fread_cached", 64 << 20, 0}};
+    for (size_t c = 0; c < sizeof(configs) / sizeof(*configs); ++c) {
+        zip_cache_limit(configs[c].limit);
+        zip_cache_set_pool(configs[c].pooled ? pool : NULL);
+        rng_state = 0x5851F42D4C957F2D;
+        uint64_t total = 0;
+        struct timer t = timer_start();
+        for (size_t i = 0; i < num_reads; ++i) {
+            const struct zip_entry *e = entries + rng() % n;
+            struct zip_file *file = zip_fopen(fp, e, NULL);
+            if (file && zip_fseek(file, rng() % (e->uncompressed_size - read_size), SEEK_SET) == 0)
+                total += zip_fread(buf, read_size, file);
+            zip_fclose(file);
+        }
+        report("cache", configs[c].name, num_reads, total, t);
+        zip_cache_purge(fp);
+    }
+    zip_cache_set_pool(NULL);
+    zip_pool_destroy(pool);
+
+    free(buf);
+    free(entries);
+    fclose(fp);
+}
+
+static int write_crc(const void *data, size_t size, void *user) {
+    *(uint32_t *)user = zip_crc32(*(uint32_t *)user, data, size);
+    return 0;
+}
+
+// zip_extract with each backend over growing entry sizes, first size where zlib wins is the auto threshold
+static void bench_codec(size_t total_size) {
+    static const struct {
+        const char *name;
+        enum zip_codec codec;
+    } codecs[] = {{"stb", ZIP_CODEC_STB}, {"zlib", ZIP_CODEC_ZLIB}, {"auto", ZIP_CODEC_AUTO}};
+    size_t crossover = 0;
+    for (size_t size = 64; size <= (4 << 20); size *= 4) {
+        size_t num_files = total_size / size < NUM_CORPUS ? NUM_CORPUS : total_size / size;
+        FILE *fp = make_deflated(num_files, size);
+        struct zip_entry *entries = NULL;
+        size_t n = fp ? zip_read(&entries, fp) : 0;
+        if (n != num_files) {
+            fprintf(stderr, "error: can't read generated archive\n");
+            exit(EXIT_FAILURE);
+        }
+
+        double seconds[3];
+        uint32_t crc[3] = {0, 0, 0};
+        for (int c = 0; c < 3; ++c) {
+            char name[64];
+            snprintf(name, sizeof(name), "zip_extract_%zu_%s", size, codecs[c].name);
+            struct timer t = timer_start();
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t entry_crc = 0;
+                if (zip_extract(fp, entries + i, write_crc, &entry_crc, codecs[c].codec, NULL)) {
+                    fprintf(stderr, "error: %s failed on %s\n", codecs[c].name, entries[i].filename);
+                    exit(EXIT_FAILURE);
+                }
+                crc[c] ^= entry_crc;
+            }
+            seconds[c] = timer_start().seconds - t.seconds;
+            report("codec", name, n, (uint64_t)n * size, t);
+        }
+        if (crc[0] != crc[1] || crc[0] != crc[2]) {
+            fprintf(stderr, "error: backends disagree on %zu byte entries\n", size);
+            exit(EXIT_FAILURE);
+        }
+        if (!crossover && seconds[1] < seconds[0])
+            crossover = size;
+
+        free(entries);
+        fclose(fp);
+    }
+    if (zip_codec_select(&(struct zip_entry){.uncompressed_size = UINT64_MAX}, ZIP_CODEC_ZLIB) != ZIP_CODEC_ZLIB)
+        fprintf(stderr, "codec: library built without zlib, both runs used stb\n");
+    else if (crossover)
+        fprintf(stderr, "codec: zlib is faster from %zu byte entries\n", crossover);
+    else
+        fprintf(stderr, "codec: stb is faster at every size\n");
+}
+
+// filter and scan over array of structs versus columnar table
+static void bench_table(size_t num_entries, int repeat) {
+    FILE *fp = make_many_small(num_entries, 256);
+    struct zip_entry *entries = NULL;
+    struct zip_table table;
+    size_t n = fp ? zip_read(&entries, fp) : 0;
+    if (!(n == num_entries && zip_read_table(&table, fp, NULL) == 0 && table.num_entries == n)) {
+        fprintf(stderr, "error: can't read generated archive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    static const char prefix[] = "dir7/";
+    volatile uint64_t sink = 0;
+    struct timer t;
+
+    t = timer_start();
+    for (int r = 0; r < repeat; ++r) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            sum += entries[i].uncompressed_size;
+        sink += sum;
+    }
+    report("table", "aos_sum_size", n * repeat, 0, t);
+
+    t = timer_start();
+    for (int r = 0; r < repeat; ++r) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            sum += table.uncompressed_size[i];
+        sink += sum;
+    }
+    report("table", "soa_sum_size", n * repeat, 0, t);
+
+    t = timer_start();
+    for (int r = 0; r < repeat; ++r) {
+        uint64_t count = 0;
+        for (size_t i = 0; i < n; ++i)
+            count += entries[i].compressed_size > 128 && entries[i].local_header_offset & 1;
+        sink += count;
+    }
+    report("table", "aos_filter_size_offset", n * repeat, 0, t);
+
+    t = timer_start();
+    for (int r = 0; r < repeat; ++r) {
+        uint64_t count = 0;
+        for (size_t i = 0; i < n; ++i)
+            count += table.compressed_size[i] > 128 && table.local_header_offset[i] & 1;
+        sink += count;
+    }
+    report("table", "soa_filter_size_offset", n * repeat, 0, t);
+
+    t = timer_start();
+    for (int r = 0; r < repeat; ++r) {
+        uint64_t count = 0;
+        for (size_t i = 0; i < n; ++i)
+            count += strlen(entries[i].filename) > sizeof(prefix) - 1 && !memcmp(entries[i].filename, prefix, sizeof(prefix) - 1);
+        sink += count;
+    }
+    report("table", "aos_filter_prefix", n * repeat, 0, t);
+
+    t = timer_start();
+    for (int r = 0; r < repeat; ++r) {
+        uint64_t count = 0;
+        for (size_t i = 0; i < n; ++i)
+            count += table.filename_length[i] > sizeof(prefix) - 1 && !memcmp(zip_table_filename(&table, i), prefix, sizeof(prefix) - 1);
+        sink += count;
+    }
+    report("table", "soa_filter_prefix", n * repeat, 0, t);
+
+    zip_table_free(&table);
+    free(entries);
+    fclose(fp);
+}
+
+int main(int argc, char **argv) {
+    size_t num_entries = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+
+    bench_inflate(8 << 20, 3);
+    bench_open(num_entries);
+    bench_lookup(num_entries, 100000);
+    bench_overlay(num_entries / 10, 100000);
+    bench_extract("many_small", 2000, 16 << 10);
+    bench_extract("few_huge", 4, 8 << 20);
+    bench_cache(200, 4096);
+    bench_codec(16 << 20);
+    bench_table(num_entries, 20);
+
+    printf("\n]\n");
+    return 0;
+}
@@ -1,2 +1,3 @@
 #define NOZIP_IMPLEMENTATION
+#define STB_INFLATE_IMPLEMENTATION
 #include "nozip.h"
@@ -13,6 +13,47 @@
 #define NOZIPDEF extern
 #endif
 
+// allocator hooks, NULL allocator argument means malloc and free
+struct zip_allocator {
+    void *(*malloc)(void *context, size_t size);
+    void (*free)(void *context, void *ptr);
+    void *context;
+};
+
+// preallocated cache-aligned slabs, see zip_pool_create
+struct zip_pool;
+
+// stack of archives merged into one name index, see zip_overlay_create
+struct zip_overlay;
+
+// size of decoder state slab used by zip_fopen handles
+#define ZIP_DECODER_SIZE (48 << 10)
+
+// inflate backend, zlib is available when library is built with NOZIP_ZLIB
+enum zip_codec {
+    ZIP_CODEC_AUTO, // per entry by uncompressed size, see zip_codec_threshold
+    ZIP_CODEC_STB,
+    ZIP_CODEC_ZLIB,
+};
+
+struct stbi__stats;
+
+// zip_test verdict for one entry
+enum zip_test_error {
+    ZIP_TEST_OK,
+    ZIP_TEST_IO,      // data is past end of file or read failed
+    ZIP_TEST_HEADER,  // local header is missing or disagrees with central directory
+    ZIP_TEST_METHOD,  // compression method isn't stored or deflate
+    ZIP_TEST_DATA,    // malformed deflate stream
+    ZIP_TEST_SIZE,    // decoded size differs from central directory
+    ZIP_TEST_CRC,
+};
+
+struct zip_test_result {
+    enum zip_test_error error;
+    double seconds;
+};
+
 struct zip_entry {
     uint64_t uncompressed_size;
     uint64_t compressed_size;
@@ -21,15 +62,207 @@ struct zip_entry {
     time_t mtime;
 };
 
+// opt-in reader counters
+struct zip_stats {
+    size_t seeks;
+    size_t reads;
+    uint64_t read_bytes;
+    double io_seconds;
+};
+
+// entry file handle, see zip_fopen
+struct zip_file;
+
+struct zip_cache_stats {
+    size_t hits;
+    size_t misses;
+    size_t shared; // hits after waiting for another thread's decode
+    size_t evictions;
+    size_t size;
+    size_t limit;
+};
+
+// columnar entry table, filenames are zero-terminated in one arena
+struct zip_table {
+    size_t num_entries;
+    uint64_t *local_header_offset;
+    uint64_t *compressed_size;
+    uint64_t *uncompressed_size;
+    time_t *mtime;
+    uint32_t *crc_32;
+    uint32_t *filename_offset;
+    uint16_t *filename_length;
+    uint16_t *compression_method;
+    char *filenames;
+    struct zip_allocator allocator;
+};
+
+#define zip_table_filename(table, i) ((table)->filenames + (table)->filename_offset[i])
+
+// directory tree node, paths point into entry filenames and aren't zero-terminated
+struct zip_dirent {
+    const char *path;
+    size_t path_length;
+    const char *name;
+    size_t name_length;
+    const struct zip_entry *entry; // NULL for directories that only appear in filenames
+    size_t first_child;
+    size_t num_children;
+    int directory;
+};
+
+// nodes sorted by parent path then name, so children of each directory are contiguous
+struct zip_dir {
+    struct zip_dirent root;
+    struct zip_dirent *nodes;
+    size_t num_nodes;
+    struct zip_allocator allocator;
+};
+
+// index sidecar file, mapped and used in place
+struct zip_index {
+    uint32_t signature;
+    uint32_t version;
+    uint64_t index_size;
+    uint64_t archive_size;
+    int64_t archive_mtime;
+    uint32_t eocdr_crc_32;
+    uint32_t reserved;
+    uint64_t num_entries;
+    // followed by entries sorted by filename and zero-terminated filenames
+};
+
+struct zip_index_entry {
+    uint64_t data_offset;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    int64_t mtime;
+    uint64_t filename_offset;
+    uint32_t crc_32;
+    uint16_t compression_method;
+    uint16_t filename_length;
+};
+
+#define zip_index_entries(index) ((const struct zip_index_entry *)((index) + 1))
+#define zip_index_filename(index, entry) ((const char *)(index) + (entry)->filename_offset)
+
 NOZIPDEF size_t zip_read(struct zip_entry **ptr, FILE *stream);
 NOZIPDEF int zip_seek(FILE *stream, const struct zip_entry *entry);
 
+// same as zip_read but central directory is loaded at once and parsed by num_threads threads
+NOZIPDEF size_t zip_read_mt(struct zip_entry **ptr, FILE *stream, int num_threads, const struct zip_allocator *allocator);
+
+// size of buffer zip_read_into needs, 0 on error
+NOZIPDEF size_t zip_read_size(FILE *stream);
+// same as zip_read but entries and filenames are stored in caller supplied buffer aligned for zip_entry
+NOZIPDEF size_t zip_read_into(struct zip_entry *entries, size_t size, FILE *stream);
+
+// call back for each central directory entry without loading the whole array,
+// entry is valid only during the call, nonzero return stops iteration,
+// returns number of entries called back or (size_t)-1 on error, callbacks made before a bad record still happened
+NOZIPDEF size_t zip_iterate(FILE *stream, int (*callback)(const struct zip_entry *entry, void *user), void *user,
+                            const struct zip_allocator *allocator);
+
+// read central directory straight into columnar table, returns 0 on success
+NOZIPDEF int zip_read_table(struct zip_table *table, FILE *stream, const struct zip_allocator *allocator);
+NOZIPDEF void zip_table_free(struct zip_table *table);
+
+// build directory tree over entries, which must outlive it, returns 0 on success
+NOZIPDEF int zip_dir_build(struct zip_dir *dir, const struct zip_entry *entries, size_t num_entries,
+                           const struct zip_allocator *allocator);
+NOZIPDEF void zip_dir_free(struct zip_dir *dir);
+// find file or directory by path, "" is root
+NOZIPDEF const struct zip_dirent *zip_stat(const struct zip_dir *dir, const char *path);
+// children of directory at path, NULL if there's no such directory
+NOZIPDEF const struct zip_dirent *zip_readdir(const struct zip_dir *dir, const char *path, size_t *num_children);
+
+// write index of archive to path, returns 0 on success
+NOZIPDEF int zip_index_write(FILE *stream, const char *path, const struct zip_allocator *allocator);
+// map index from path, returns NULL if it's missing, doesn't match archive size, mtime or end of central directory,
+// or has a filename outside of the file
+NOZIPDEF const struct zip_index *zip_index_open(FILE *stream, const char *path);
+NOZIPDEF void zip_index_close(const struct zip_index *index);
+NOZIPDEF const struct zip_index_entry *zip_index_find(const struct zip_index *index, const char *filename);
+// seek stream to entry data, no local header read
+NOZIPDEF int zip_index_seek(FILE *stream, const struct zip_index_entry *entry);
+
+// overlay of archives where later layers shadow same paths in earlier ones, lookup is one hash probe regardless of layer count
+NOZIPDEF struct zip_overlay *zip_overlay_create(const struct zip_allocator *allocator);
+NOZIPDEF void zip_overlay_destroy(struct zip_overlay *overlay);
+// read central directory of stream, which must stay open, and put it on top, returns layer id or -1 on error,
+// including central directories whose records don't fit in their stated size
+NOZIPDEF int zip_overlay_push(struct zip_overlay *overlay, FILE *stream);
+// drop layer, paths it shadowed resolve to earlier layers again, returns 0 on success
+NOZIPDEF int zip_overlay_remove(struct zip_overlay *overlay, int layer);
+// newest entry for filename, stream of its archive is stored in stream if it's not NULL
+NOZIPDEF const struct zip_entry *zip_overlay_find(const struct zip_overlay *overlay, const char *filename, FILE **stream);
+
+NOZIPDEF uint32_t zip_crc32(uint32_t crc, const void *data, size_t size);
+
+// entries of at least size bytes go to zlib in auto mode
+NOZIPDEF void zip_codec_threshold(uint64_t size);
+// resolve codec for entry, requests for unavailable zlib fall back to stb
+NOZIPDEF enum zip_codec zip_codec_select(const struct zip_entry *entry, enum zip_codec codec);
+// decompress entry into write callback, nonzero return from write stops, zlib state comes from allocator,
+// returns 0 on success
+NOZIPDEF int zip_extract(FILE *stream, const struct zip_entry *entry, int (*write)(const void *data, size_t size, void *user),
+                         void *user, enum zip_codec codec, const struct zip_allocator *allocator);
+// verify every table entry with num_threads threads, walking entries in archive order with large sequential reads,
+// results has one slot per entry in table order, returns number of failed entries or -1 on error
+NOZIPDEF long zip_test(FILE *stream, const struct zip_table *table, struct zip_test_result *results, int num_threads,
+                       const struct zip_allocator *allocator);
+// collect stb_inflate counters of zip_extract into stats, NULL turns it off,
+// each call counts privately and adds its totals atomically when done
+NOZIPDEF void zip_set_inflate_stats(struct stbi__stats *stats);
+
+// open entry for reading, deflated data is decoded in chunks shared by all handles through a process-wide cache,
+// handles are independent and may be used from different threads on the same stream
+NOZIPDEF struct zip_file *zip_fopen(FILE *stream, const struct zip_entry *entry, const struct zip_allocator *allocator);
+NOZIPDEF size_t zip_fread(void *ptr, size_t size, struct zip_file *file);
+NOZIPDEF int zip_fseek(struct zip_file *file, int64_t offset, int whence);
+NOZIPDEF uint64_t zip_ftell(const struct zip_file *file);
+NOZIPDEF void zip_fclose(struct zip_file *file);
+
+// bound decompressed chunk cache in bytes, 64 MB by default
+NOZIPDEF void zip_cache_limit(size_t size);
+// allocator for cached chunks, drops chunks allocated with previous one
+NOZIPDEF void zip_cache_set_allocator(const struct zip_allocator *allocator);
+// take decoder state for cache misses from pool instead of the stack, waiting when all slabs are busy,
+// pool slabs must be at least ZIP_DECODER_SIZE, returns 0 on success
+NOZIPDEF int zip_cache_set_pool(struct zip_pool *pool);
+// drop cached chunks of archive, must be called before closing stream
+NOZIPDEF void zip_cache_purge(FILE *stream);
+NOZIPDEF void zip_cache_get_stats(struct zip_cache_stats *stats);
+
+// pool of num_slabs slabs of slab_size bytes each, aligned to cache line, allocated once
+NOZIPDEF struct zip_pool *zip_pool_create(size_t slab_size, size_t num_slabs, const struct zip_allocator *allocator);
+NOZIPDEF void zip_pool_destroy(struct zip_pool *pool);
+// take free slab, waits until one is released if all are taken
+NOZIPDEF void *zip_pool_acquire(struct zip_pool *pool);
+NOZIPDEF void zip_pool_release(struct zip_pool *pool, void *slab);
+
+// count seeks and reads issued by reader functions into stats, NULL turns it off,
+// counters are added atomically so threads may read at once, read stats after they are done
+NOZIPDEF void zip_set_stats(struct zip_stats *stats);
+
 #endif // NOZIP_H
 
 #ifdef NOZIP_IMPLEMENTATION
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stb_inflate.h"
+
+#ifdef NOZIP_ZLIB
+#include <zlib.h>
+#endif
 
 #if defined(__GNUC__) || defined(__clang__)
 #define PACK(x) x __attribute__((__packed__))
@@ -104,135 +337,1965 @@ PACK(struct end_of_central_dir_record {
     uint16_t ZIP_file_comment_length;
 });
 
-size_t zip_read(struct zip_entry **ptr, FILE *stream) {
+// counters are shared by every thread reading any archive, each add is a relaxed atomic so none is lost or torn
+#define zip_atomic_add(counter, value) __atomic_fetch_add(counter, value, __ATOMIC_RELAXED)
+
+static void zip_atomic_add_seconds(double *sum, double seconds) {
+    double old, sum_new;
+    __atomic_load(sum, &old, __ATOMIC_RELAXED);
+    do
+        sum_new = old + seconds;
+    while (!__atomic_compare_exchange(sum, &old, &sum_new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static struct zip_stats *zip_stats;
+
+void zip_set_stats(struct zip_stats *stats) {
+    __atomic_store_n(&zip_stats, stats, __ATOMIC_RELEASE);
+}
+
+static double zip_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int zip_io_seek(FILE *stream, off_t offset, int whence) {
+    struct zip_stats *stats = __atomic_load_n(&zip_stats, __ATOMIC_ACQUIRE);
+    if (!stats)
+        return fseeko(stream, offset, whence);
+    double t = zip_now();
+    int ret = fseeko(stream, offset, whence);
+    zip_atomic_add_seconds(&stats->io_seconds, zip_now() - t);
+    zip_atomic_add(&stats->seeks, 1);
+    return ret;
+}
+
+static size_t zip_io_read(void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    struct zip_stats *stats = __atomic_load_n(&zip_stats, __ATOMIC_ACQUIRE);
+    if (!stats)
+        return fread(ptr, size, nmemb, stream);
+    double t = zip_now();
+    size_t ret = fread(ptr, size, nmemb, stream);
+    zip_atomic_add_seconds(&stats->io_seconds, zip_now() - t);
+    zip_atomic_add(&stats->reads, 1);
+    zip_atomic_add(&stats->read_bytes, (uint64_t)ret * size);
+    return ret;
+}
+
+static void *zip_default_malloc(void *context, size_t size) {
+    (void)context;
+    return malloc(size);
+}
+
+static void zip_default_free(void *context, void *ptr) {
+    (void)context;
+    free(ptr);
+}
+
+static const struct zip_allocator zip_default_allocator = {zip_default_malloc, zip_default_free, NULL};
+
+static const struct zip_allocator *zip_allocator_or_default(const struct zip_allocator *allocator) {
+    return allocator ? allocator : &zip_default_allocator;
+}
+
+static void *zip_malloc(const struct zip_allocator *allocator, size_t size) {
+    return allocator->malloc(allocator->context, size);
+}
+
+static void zip_free(const struct zip_allocator *allocator, void *ptr) {
+    if (ptr)
+        allocator->free(allocator->context, ptr);
+}
+
+struct central_dir {
+    struct end_of_central_dir_record eocdr;
+    uint64_t num_entries;
+    uint64_t size;
+    uint64_t offset;
+};
+
+// locate central directory and seek stream to its first header
+static int zip_find_central_dir(struct central_dir *cd, FILE *stream) {
     // find the end of central directory record
     uint32_t signature;
     off_t offset;
     for (offset = sizeof(struct end_of_central_dir_record);; ++offset) {
-        if (offset > UINT16_MAX || fseeko(stream, -offset, SEEK_END) || !fread(&signature, sizeof(signature), 1, stream))
-            return 0;
+        if (offset > UINT16_MAX || zip_io_seek(stream, -offset, SEEK_END) || !zip_io_read(&signature, sizeof(signature), 1, stream))
+            return 1;
         if (signature == 0x06054B50)
             break;
     }
 
     // read end of central directory record
     struct end_of_central_dir_record eocdr;
-    if (!(fseeko(stream, -offset, SEEK_END) == 0 &&
-          fread(&eocdr, sizeof(eocdr), 1, stream) &&
+    if (!(zip_io_seek(stream, -offset, SEEK_END) == 0 &&
+          zip_io_read(&eocdr, sizeof(eocdr), 1, stream) &&
           eocdr.signature == 0x06054B50 &&
           eocdr.disk_number == 0 &&
           eocdr.cdr_disk_number == 0 &&
           eocdr.disk_num_entries == eocdr.num_entries))
-        return 0;
+        return 1;
+
+    cd->eocdr = eocdr;
+    cd->num_entries = eocdr.num_entries;
+    cd->size = eocdr.cdr_size;
+    cd->offset = eocdr.cdr_offset;
 
     // check for zip64
-    struct end_of_central_dir_record64 eocdr64;
-    int zip64 = eocdr.num_entries == UINT16_MAX || eocdr.cdr_offset == UINT32_MAX || eocdr.cdr_size == UINT32_MAX;
-    if (zip64) {
+    if (eocdr.num_entries == UINT16_MAX || eocdr.cdr_offset == UINT32_MAX || eocdr.cdr_size == UINT32_MAX) {
         // zip64 end of central directory locator
         struct end_of_central_dir_locator64 eocdl64;
-        if (!(fseeko(stream, -offset - sizeof(eocdl64), SEEK_END) == 0 &&
-              fread(&eocdl64, sizeof(eocdl64), 1, stream) &&
+        if (!(zip_io_seek(stream, -offset - sizeof(eocdl64), SEEK_END) == 0 &&
+              zip_io_read(&eocdl64, sizeof(eocdl64), 1, stream) &&
               eocdl64.signature == 0x07064B50 &&
               eocdl64.eocdr_disk == 0 &&
               eocdl64.num_disks == 1))
-            return 0;
+            return 1;
         // zip64 end of central directory record
-        if (!(fseeko(stream, eocdl64.eocdr_offset, SEEK_SET) == 0 &&
-              fread(&eocdr64, sizeof(eocdr64), 1, stream) &&
+        struct end_of_central_dir_record64 eocdr64;
+        if (!(zip_io_seek(stream, eocdl64.eocdr_offset, SEEK_SET) == 0 &&
+              zip_io_read(&eocdr64, sizeof(eocdr64), 1, stream) &&
               eocdr64.signature == 0x06064B50 &&
               eocdr64.disk_number == 0 &&
               eocdr64.cdr_disk_number == 0 &&
               eocdr64.disk_num_entries == eocdr64.num_entries))
-            return 0;
+            return 1;
+        cd->num_entries = eocdr64.num_entries;
+        cd->size = eocdr64.cdr_size;
+        cd->offset = eocdr64.cdr_offset;
     }
 
+    // every entry needs at least a header inside central directory
+    if (cd->num_entries > cd->size / sizeof(struct central_dir_header))
+        return 1;
+
     // seek to central directory record
-    if (fseeko(stream, zip64 ? eocdr64.cdr_offset : eocdr.cdr_offset, SEEK_SET))
+    return zip_io_seek(stream, cd->offset, SEEK_SET) != 0;
+}
+
+// last converted timestamp, neighbour entries usually share it and mktime is slow and serialized by libc
+struct dos_time_cache {
+    uint32_t date_time;
+    time_t mtime;
+};
+
+static time_t zip_mktime(struct dos_time_cache *cache, uint16_t date, uint16_t time) {
+    uint32_t date_time = (uint32_t)date << 16 | time;
+    if (cache->date_time != date_time || date_time == 0) {
+        cache->date_time = date_time;
+        cache->mtime = mktime(&(struct tm){
+            .tm_sec = (time << 1) & 0x3F,
+            .tm_min = (time >> 5) & 0x3F,
+            .tm_hour = (time >> 11) & 0x1F,
+            .tm_mday = date & 0x1F,
+            .tm_mon = ((date >> 5) & 0xF) - 1,
+            .tm_year = ((date >> 9) & 0x7F) + 1980 - 1900,
+            .tm_isdst = -1,
+        });
+    }
+    return cache->mtime;
+}
+
+// fill entry from central directory header and its extra field
+static void zip_parse_central_dir_header(struct zip_entry *entry, const struct central_dir_header *cdh, const char *extra,
+                                         struct dos_time_cache *cache) {
+    entry->uncompressed_size = cdh->uncompressed_size;
+    entry->compressed_size = cdh->compressed_size;
+    entry->local_header_offset = cdh->local_header_offset;
+
+    // find zip64 extended information extra field, fields running past extra field end are ignored
+    for (const char *extra_end = extra + cdh->extra_field_length; extra_end - extra >= 4;) {
+        uint16_t header_id;
+        memcpy(&header_id, extra, sizeof(header_id));
+        extra += sizeof(header_id);
+
+        uint16_t data_size;
+        memcpy(&data_size, extra, sizeof(data_size));
+        extra += sizeof(data_size);
+        if (data_size > extra_end - extra)
+            break;
+
+        const char *data = extra, *data_end = extra + data_size;
+        extra = data_end;
+        switch (header_id) {
+        case 0x0001:
+            if (cdh->uncompressed_size == UINT32_MAX && data_end - data >= 8) {
+                memcpy(&entry->uncompressed_size, data, sizeof(entry->uncompressed_size));
+                data += sizeof(entry->uncompressed_size);
+            }
+            if (cdh->compressed_size == UINT32_MAX && data_end - data >= 8) {
+                memcpy(&entry->compressed_size, data, sizeof(entry->compressed_size));
+                data += sizeof(entry->compressed_size);
+            }
+            if (cdh->local_header_offset == UINT32_MAX && data_end - data >= 8) {
+                memcpy(&entry->local_header_offset, data, sizeof(entry->local_header_offset));
+                data += sizeof(entry->local_header_offset);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    entry->mtime = zip_mktime(cache, cdh->last_mod_file_date, cdh->last_mod_file_time);
+}
+
+// read header of entry i at offset into central directory and advance offset, store zero-terminated filename in strings,
+// record has to end early enough to leave room for headers of the entries after it, so entries array and filenames
+// written so far fit in central directory size like zip_read assumes
+static int zip_read_central_dir_header(struct zip_entry *entry, struct central_dir_header *cdh, char *strings, FILE *stream,
+                                       const struct central_dir *cd, uint64_t *offset, uint64_t i, struct dos_time_cache *cache) {
+    // read central directory header, filename, extra field and skip comment
+    if (!(zip_io_read(cdh, sizeof(*cdh), 1, stream) &&
+          cdh->signature == 0x02014B50 &&
+          (*offset += sizeof(*cdh) + cdh->file_name_length + cdh->extra_field_length + cdh->file_comment_length) <=
+              cd->size - (cd->num_entries - i - 1) * sizeof(*cdh) &&
+          zip_io_read(strings, cdh->file_name_length + cdh->extra_field_length, 1, stream) &&
+          (cdh->file_comment_length == 0 || zip_io_seek(stream, cdh->file_comment_length, SEEK_CUR) == 0)))
+        return -1;
+
+    zip_parse_central_dir_header(entry, cdh, strings + cdh->file_name_length, cache);
+    entry->filename = strings;
+    strings[cdh->file_name_length] = '\0';
+    return cdh->file_name_length;
+}
+
+static size_t zip_parse_central_dir(struct zip_entry *entries, const struct central_dir *cd, FILE *stream) {
+    // store filenames after entries array
+    char *strings = (char *)(entries + cd->num_entries);
+
+    struct central_dir_header cdh;
+    struct dos_time_cache cache = {0};
+    uint64_t offset = 0;
+    for (size_t i = 0; i < cd->num_entries; ++i) {
+        int length = zip_read_central_dir_header(entries + i, &cdh, strings, stream, cd, &offset, i, &cache);
+        if (length < 0)
+            return 0;
+        strings += length + 1;
+    }
+    return cd->num_entries;
+}
+
+size_t zip_read(struct zip_entry **ptr, FILE *stream) {
+    struct central_dir cd;
+    if (zip_find_central_dir(&cd, stream))
         return 0;
 
     // alloc buffer for entries array and filenames
-    struct zip_entry *entries = (struct zip_entry *)malloc(zip64 ? eocdr64.cdr_size : eocdr.cdr_size);
+    struct zip_entry *entries = (struct zip_entry *)malloc(cd.size);
     if (!entries)
         return 0;
 
-    // store filenames after entries array
-    char *strings = (char *)(entries + (zip64 ? eocdr64.num_entries : eocdr.num_entries));
+    size_t num_entries = zip_parse_central_dir(entries, &cd, stream);
+    if (!num_entries) {
+        free(entries);
+        return 0;
+    }
 
-    for (size_t i = 0, i_end = zip64 ? eocdr64.num_entries : eocdr.num_entries; i < i_end; ++i) {
-        // read central directory header, filename, extra field and skip comment
-        struct central_dir_header cdh;
-        if (!(fread(&cdh, sizeof(cdh), 1, stream) &&
-              cdh.signature == 0x02014B50 &&
-              fread(strings, cdh.file_name_length + cdh.extra_field_length, 1, stream) &&
-              fseeko(stream, cdh.file_comment_length, SEEK_CUR) == 0)) {
-            free(entries);
-            return 0;
-        }
+    *ptr = entries;
+    return num_entries;
+}
 
-        struct zip_entry *entry = entries + i;
-        entry->uncompressed_size = cdh.uncompressed_size;
-        entry->compressed_size = cdh.compressed_size;
-        entry->local_header_offset = cdh.local_header_offset;
-
-        // find zip64 extended information extra field
-        for (char *extra = strings + cdh.file_name_length; extra != strings + cdh.file_name_length + cdh.extra_field_length;) {
-            uint16_t header_id;
-            memcpy(&header_id, extra, sizeof(header_id));
-            extra += sizeof(header_id);
-
-            uint16_t data_size;
-            memcpy(&data_size, extra, sizeof(data_size));
-            extra += sizeof(data_size);
-
-            switch (header_id) {
-            case 0x0001:
-                if (cdh.uncompressed_size == UINT32_MAX) {
-                    memcpy(&entry->uncompressed_size, extra, sizeof(entry->uncompressed_size));
-                    extra += sizeof(entry->uncompressed_size);
-                }
-                if (cdh.compressed_size == UINT32_MAX) {
-                    memcpy(&entry->compressed_size, extra, sizeof(entry->compressed_size));
-                    extra += sizeof(entry->compressed_size);
-                }
-                if (cdh.local_header_offset == UINT32_MAX) {
-                    memcpy(&entry->local_header_offset, extra, sizeof(entry->local_header_offset));
-                    extra += sizeof(entry->local_header_offset);
-                }
-                if (cdh.disk_number_start == UINT16_MAX) {
-                    extra += sizeof(uint32_t);
-                }
-                break;
-            default:
-                extra += data_size;
-                break;
-            }
+size_t zip_read_size(FILE *stream) {
+    // central directory size is enough, entry and terminated filename are never larger than the record
+    // and zip_read_central_dir_header fails on records that don't fit in central directory size
+    struct central_dir cd;
+    return zip_find_central_dir(&cd, stream) ? 0 : cd.size;
+}
+
+size_t zip_read_into(struct zip_entry *entries, size_t size, FILE *stream) {
+    struct central_dir cd;
+    // records are bounded by cd.size while parsing, so a buffer of that size holds whatever they produce
+    if (zip_find_central_dir(&cd, stream) || size < cd.size)
+        return 0;
+    return zip_parse_central_dir(entries, &cd, stream);
+}
+
+size_t zip_iterate(FILE *stream, int (*callback)(const struct zip_entry *entry, void *user), void *user,
+                   const struct zip_allocator *allocator) {
+    struct central_dir cd;
+    if (zip_find_central_dir(&cd, stream))
+        return (size_t)-1;
+
+    // single buffer reused for every entry, large enough for any filename and extra field
+    allocator = zip_allocator_or_default(allocator);
+    char *strings = (char *)zip_malloc(allocator, 2 * UINT16_MAX);
+    if (!strings)
+        return (size_t)-1;
+
+    struct central_dir_header cdh;
+    struct dos_time_cache cache = {0};
+    uint64_t offset = 0;
+    size_t i = 0;
+    for (struct zip_entry entry; i < cd.num_entries; ++i) {
+        if (zip_read_central_dir_header(&entry, &cdh, strings, stream, &cd, &offset, i, &cache) < 0) {
+            i = (size_t)-1;
+            break;
+        }
+        if (callback(&entry, user)) {
+            ++i;
+            break;
         }
+    }
 
+    zip_free(allocator, strings);
+    return i;
+}
+
+struct central_dir_slice {
+    const char *records;
+    struct zip_entry *entries;
+    char *strings;
+    size_t num_entries;
+};
+
+static void *zip_parse_central_dir_slice(void *arg) {
+    const struct central_dir_slice *slice = (const struct central_dir_slice *)arg;
+    const char *records = slice->records;
+    char *strings = slice->strings;
+    struct dos_time_cache cache = {0};
+    for (size_t i = 0; i < slice->num_entries; ++i) {
+        struct central_dir_header cdh;
+        memcpy(&cdh, records, sizeof(cdh));
+        records += sizeof(cdh);
+
+        struct zip_entry *entry = slice->entries + i;
+        zip_parse_central_dir_header(entry, &cdh, records + cdh.file_name_length, &cache);
         entry->filename = strings;
+        memcpy(strings, records, cdh.file_name_length);
         strings += cdh.file_name_length;
         *strings++ = '\0';
-        entry->mtime = mktime(&(struct tm){
-            .tm_sec = (cdh.last_mod_file_time << 1) & 0x3F,
-            .tm_min = (cdh.last_mod_file_time >> 5) & 0x3F,
-            .tm_hour = (cdh.last_mod_file_time >> 11) & 0x1F,
-            .tm_mday = cdh.last_mod_file_date & 0x1F,
-            .tm_mon = ((cdh.last_mod_file_date >> 5) & 0xF) - 1,
-            .tm_year = ((cdh.last_mod_file_date >> 9) & 0x7F) + 1980 - 1900,
-            .tm_isdst = -1,
-        });
+
+        records += cdh.file_name_length + cdh.extra_field_length + cdh.file_comment_length;
+    }
+    return NULL;
+}
+
+size_t zip_read_mt(struct zip_entry **ptr, FILE *stream, int num_threads, const struct zip_allocator *allocator) {
+    struct central_dir cd;
+    if (zip_find_central_dir(&cd, stream))
+        return 0;
+
+    allocator = zip_allocator_or_default(allocator);
+    if (num_threads < 1)
+        num_threads = 1;
+    if ((uint64_t)num_threads > cd.num_entries)
+        num_threads = cd.num_entries ? cd.num_entries : 1;
+
+    // read whole central directory, output buffer has the same layout as zip_read
+    char *records = (char *)zip_malloc(allocator, cd.size);
+    struct zip_entry *entries = (struct zip_entry *)zip_malloc(allocator, cd.size);
+    struct central_dir_slice *slices = (struct central_dir_slice *)zip_malloc(allocator, num_threads * sizeof(*slices));
+    if (!(records && entries && slices && (cd.size == 0 || zip_io_read(records, cd.size, 1, stream)))) {
+        zip_free(allocator, records);
+        zip_free(allocator, entries);
+        zip_free(allocator, slices);
+        return 0;
     }
+    memset(slices, 0, num_threads * sizeof(*slices));
+
+    // validate record boundaries and split them into equal slices
+    uint64_t record_offset = 0;
+    uint64_t string_offset = cd.num_entries * sizeof(struct zip_entry);
+    for (size_t i = 0, t = 0; i < cd.num_entries; ++i) {
+        if (t < (size_t)num_threads && i == t * cd.num_entries / num_threads) {
+            slices[t].records = records + record_offset;
+            slices[t].entries = entries + i;
+            slices[t].strings = (char *)entries + string_offset;
+            slices[t].num_entries = (t + 1) * cd.num_entries / num_threads - i;
+            ++t;
+        }
+        struct central_dir_header cdh;
+        if (record_offset + sizeof(cdh) <= cd.size)
+            memcpy(&cdh, records + record_offset, sizeof(cdh));
+        if (!(record_offset + sizeof(cdh) <= cd.size &&
+              cdh.signature == 0x02014B50 &&
+              (record_offset += sizeof(cdh) + cdh.file_name_length + cdh.extra_field_length + cdh.file_comment_length) <= cd.size)) {
+            zip_free(allocator, records);
+            zip_free(allocator, entries);
+            zip_free(allocator, slices);
+            return 0;
+        }
+        string_offset += cdh.file_name_length + 1;
+    }
+
+    // first slice is parsed by calling thread
+    pthread_t *threads = (pthread_t *)zip_malloc(allocator, num_threads * sizeof(*threads));
+    int num_started = 1;
+    if (threads)
+        for (; num_started < num_threads; ++num_started)
+            if (pthread_create(threads + num_started, NULL, zip_parse_central_dir_slice, slices + num_started))
+                break;
+    zip_parse_central_dir_slice(slices);
+    for (int t = 1; t < num_started; ++t)
+        pthread_join(threads[t], NULL);
+    // parse what failed to start here
+    for (int t = num_started; t < num_threads; ++t)
+        zip_parse_central_dir_slice(slices + t);
+
+    zip_free(allocator, threads);
+    zip_free(allocator, slices);
+    zip_free(allocator, records);
 
     *ptr = entries;
-    return zip64 ? eocdr64.num_entries : eocdr.num_entries;
+    return cd.num_entries;
+}
+
+int zip_read_table(struct zip_table *table, FILE *stream, const struct zip_allocator *allocator) {
+    struct central_dir cd;
+    if (zip_find_central_dir(&cd, stream))
+        return 1;
+
+    // one block for all columns, widest first, filename arena last with room for one extra field
+    size_t n = cd.num_entries;
+    table->allocator = *zip_allocator_or_default(allocator);
+    char *block = (char *)zip_malloc(&table->allocator, n * (4 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + 2 * sizeof(uint16_t)) + cd.size);
+    if (!block)
+        return 1;
+
+    table->num_entries = n;
+    table->local_header_offset = (uint64_t *)block;
+    table->compressed_size = table->local_header_offset + n;
+    table->uncompressed_size = table->compressed_size + n;
+    table->mtime = (time_t *)(table->uncompressed_size + n);
+    table->crc_32 = (uint32_t *)(table->mtime + n);
+    table->filename_offset = table->crc_32 + n;
+    table->filename_length = (uint16_t *)(table->filename_offset + n);
+    table->compression_method = table->filename_length + n;
+    table->filenames = (char *)(table->compression_method + n);
+
+    struct central_dir_header cdh;
+    struct dos_time_cache cache = {0};
+    uint64_t offset = 0, record_offset = 0;
+    for (size_t i = 0; i < n; ++i) {
+        struct zip_entry entry;
+        int length = zip_read_central_dir_header(&entry, &cdh, table->filenames + offset, stream, &cd, &record_offset, i, &cache);
+        if (length < 0 || offset > UINT32_MAX) {
+            zip_free(&table->allocator, block);
+            return 1;
+        }
+        table->local_header_offset[i] = entry.local_header_offset;
+        table->compressed_size[i] = entry.compressed_size;
+        table->uncompressed_size[i] = entry.uncompressed_size;
+        table->mtime[i] = entry.mtime;
+        table->crc_32[i] = cdh.crc_32;
+        table->filename_offset[i] = offset;
+        table->filename_length[i] = length;
+        table->compression_method[i] = cdh.compression_method;
+        offset += length + 1;
+    }
+    return 0;
+}
+
+void zip_table_free(struct zip_table *table) {
+    zip_free(&table->allocator, table->local_header_offset);
 }
 
 int zip_seek(FILE *stream, const struct zip_entry *entry) {
     struct local_file_header lfh;
-    return !(fseeko(stream, entry->local_header_offset, SEEK_SET) == 0 &&
-             fread(&lfh, sizeof(lfh), 1, stream) &&
+    return !(zip_io_seek(stream, entry->local_header_offset, SEEK_SET) == 0 &&
+             zip_io_read(&lfh, sizeof(lfh), 1, stream) &&
              lfh.signature == 0x04034B50 &&
-             fseeko(stream, lfh.file_name_length + lfh.extra_field_length, SEEK_CUR) == 0);
+             zip_io_seek(stream, lfh.file_name_length + lfh.extra_field_length, SEEK_CUR) == 0);
+}
+
+static size_t zip_dirent_parent_length(const struct zip_dirent *d) {
+    return d->name == d->path ? 0 : d->name - d->path - 1;
+}
+
+// order by parent path, then by name
+static int zip_dirent_compare_key(const struct zip_dirent *d, const char *parent, size_t parent_length, const char *name, size_t name_length) {
+    size_t length = zip_dirent_parent_length(d);
+    int cmp = memcmp(d->path, parent, length < parent_length ? length : parent_length);
+    if (cmp || length != parent_length)
+        return cmp ? cmp : length < parent_length ? -1 : 1;
+    cmp = memcmp(d->name, name, d->name_length < name_length ? d->name_length : name_length);
+    if (cmp || d->name_length != name_length)
+        return cmp ? cmp : d->name_length < name_length ? -1 : 1;
+    return 0;
+}
+
+static int zip_dirent_compare(const void *a, const void *b) {
+    const struct zip_dirent *x = (const struct zip_dirent *)a, *y = (const struct zip_dirent *)b;
+    int cmp = zip_dirent_compare_key(x, y->path, zip_dirent_parent_length(y), y->name, y->name_length);
+    if (cmp)
+        return cmp;
+    // real entries before synthesized directories, later duplicates first
+    return (x->entry < y->entry) - (x->entry > y->entry);
+}
+
+static struct zip_dirent zip_dirent_make(const char *path, size_t length, const struct zip_entry *entry, int directory) {
+    const char *name = path + length;
+    while (name != path && name[-1] != '/')
+        --name;
+    return (struct zip_dirent){path, length, name, path + length - name, entry, 0, 0, directory};
+}
+
+static const struct zip_dirent *zip_dir_find(const struct zip_dir *dir, const char *path, size_t length) {
+    while (length && path[length - 1] == '/')
+        --length;
+    if (length == 0)
+        return &dir->root;
+    struct zip_dirent key = zip_dirent_make(path, length, NULL, 0);
+    size_t parent_length = zip_dirent_parent_length(&key);
+    size_t lo = 0, hi = dir->num_nodes;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = zip_dirent_compare_key(dir->nodes + mid, path, parent_length, key.name, key.name_length);
+        if (cmp == 0)
+            return dir->nodes + mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+int zip_dir_build(struct zip_dir *dir, const struct zip_entry *entries, size_t num_entries,
+                  const struct zip_allocator *allocator) {
+    // every entry plus every directory prefix of it
+    size_t count = 0;
+    for (size_t i = 0; i < num_entries; ++i) {
+        ++count;
+        for (const char *p = entries[i].filename; *p; ++p)
+            count += *p == '/' && p[1];
+    }
+
+    dir->allocator = *zip_allocator_or_default(allocator);
+    struct zip_dirent *nodes = (struct zip_dirent *)zip_malloc(&dir->allocator, (count ? count : 1) * sizeof(*nodes));
+    if (!nodes)
+        return 1;
+
+    size_t n = 0;
+    for (size_t i = 0; i < num_entries; ++i) {
+        const char *filename = entries[i].filename;
+        size_t length = strlen(filename);
+        int directory = length && filename[length - 1] == '/';
+        if (length - directory == 0)
+            continue;
+        nodes[n++] = zip_dirent_make(filename, length - directory, entries + i, directory);
+        for (size_t k = 1; k + 1 < length; ++k)
+            if (filename[k] == '/')
+                nodes[n++] = zip_dirent_make(filename, k, NULL, 1);
+    }
+
+    // sort and keep one node per path
+    qsort(nodes, n, sizeof(*nodes), zip_dirent_compare);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (unique && zip_dirent_compare_key(nodes + unique - 1, nodes[i].path, zip_dirent_parent_length(nodes + i),
+                                             nodes[i].name, nodes[i].name_length) == 0)
+            nodes[unique - 1].directory |= nodes[i].directory;
+        else
+            nodes[unique++] = nodes[i];
+    }
+
+    dir->root = zip_dirent_make("", 0, NULL, 1);
+    dir->nodes = nodes;
+    dir->num_nodes = unique;
+
+    // link each run of siblings to its parent
+    for (size_t i = 0, j; i < unique; i = j) {
+        size_t parent_length = zip_dirent_parent_length(nodes + i);
+        for (j = i + 1; j < unique && zip_dirent_parent_length(nodes + j) == parent_length &&
+                        memcmp(nodes[j].path, nodes[i].path, parent_length) == 0;
+             ++j)
+            ;
+        struct zip_dirent *parent = (struct zip_dirent *)zip_dir_find(dir, nodes[i].path, parent_length);
+        parent->first_child = i;
+        parent->num_children = j - i;
+        parent->directory = 1;
+    }
+    return 0;
+}
+
+void zip_dir_free(struct zip_dir *dir) {
+    zip_free(&dir->allocator, dir->nodes);
+    dir->nodes = NULL;
+    dir->num_nodes = 0;
+}
+
+const struct zip_dirent *zip_stat(const struct zip_dir *dir, const char *path) {
+    return zip_dir_find(dir, path, strlen(path));
+}
+
+const struct zip_dirent *zip_readdir(const struct zip_dir *dir, const char *path, size_t *num_children) {
+    const struct zip_dirent *d = zip_stat(dir, path);
+    if (!(d && d->directory))
+        return NULL;
+    *num_children = d->num_children;
+    return dir->nodes + d->first_child;
+}
+
+#ifndef NOZIP_ZLIB
+// slicing-by-8 tables, zip_crc32_table[k][i] is crc of byte i followed by k zero bytes
+static uint32_t zip_crc32_table[8][256];
+static pthread_once_t zip_crc32_once = PTHREAD_ONCE_INIT;
+
+static void zip_crc32_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        zip_crc32_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+        for (int k = 1; k < 8; ++k)
+            zip_crc32_table[k][i] = zip_crc32_table[0][zip_crc32_table[k - 1][i] & 0xFF] ^ (zip_crc32_table[k - 1][i] >> 8);
+}
+#endif
+
+uint32_t zip_crc32(uint32_t crc, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+#ifdef NOZIP_ZLIB
+    // zlib takes uInt sizes
+    while (size) {
+        uInt n = size < (1u << 30) ? (uInt)size : 1u << 30;
+        crc = crc32(crc, p, n);
+        p += n;
+        size -= n;
+    }
+    return crc;
+#else
+    pthread_once(&zip_crc32_once, zip_crc32_init);
+    const uint32_t(*t)[256] = (const uint32_t(*)[256])zip_crc32_table;
+    crc = ~crc;
+    for (; size >= 8; p += 8, size -= 8) {
+        // little-endian words, like the header parsing
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    while (size--)
+        crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+#endif
+}
+
+#define ZIP_INDEX_SIGNATURE 0x58495A4E // "NZIX"
+#define ZIP_INDEX_VERSION 1
+
+// fill index header fields identifying archive
+static int zip_index_stamp(struct zip_index *index, FILE *stream) {
+    struct stat st;
+    struct central_dir cd;
+    if (fstat(fileno(stream), &st) || zip_find_central_dir(&cd, stream))
+        return 1;
+    index->archive_size = st.st_size;
+    index->archive_mtime = st.st_mtime;
+    index->eocdr_crc_32 = zip_crc32(0, &cd.eocdr, sizeof(cd.eocdr));
+    index->num_entries = cd.num_entries;
+    return 0;
+}
+
+static int zip_index_compare(const void *a, const void *b) {
+    // filename_offset holds absolute address while sorting
+    return strcmp((const char *)(uintptr_t)((const struct zip_index_entry *)a)->filename_offset,
+                  (const char *)(uintptr_t)((const struct zip_index_entry *)b)->filename_offset);
+}
+
+int zip_index_write(FILE *stream, const char *path, const struct zip_allocator *allocator) {
+    struct zip_index header = {.signature = ZIP_INDEX_SIGNATURE, .version = ZIP_INDEX_VERSION};
+    struct central_dir cd;
+    if (zip_index_stamp(&header, stream) || zip_find_central_dir(&cd, stream))
+        return 1;
+
+    // filenames take less space than central directory headers
+    size_t size = sizeof(header) + cd.num_entries * sizeof(struct zip_index_entry) + cd.size;
+    allocator = zip_allocator_or_default(allocator);
+    struct zip_index *index = (struct zip_index *)zip_malloc(allocator, size);
+    char *strings = (char *)zip_malloc(allocator, 2 * UINT16_MAX);
+    if (!(index && strings)) {
+        zip_free(allocator, index);
+        zip_free(allocator, strings);
+        return 1;
+    }
+    *index = header;
+
+    struct zip_index_entry *entries = (struct zip_index_entry *)zip_index_entries(index);
+    char *filenames = (char *)(entries + cd.num_entries);
+    struct central_dir_header cdh;
+    struct dos_time_cache cache = {0};
+    uint64_t record_offset = 0;
+    int err = 0;
+    for (size_t i = 0; i < cd.num_entries; ++i) {
+        struct zip_entry entry;
+        int length = zip_read_central_dir_header(&entry, &cdh, strings, stream, &cd, &record_offset, i, &cache);
+        if (length < 0) {
+            err = 1;
+            break;
+        }
+        entries[i] = (struct zip_index_entry){
+            .data_offset = entry.local_header_offset,
+            .compressed_size = entry.compressed_size,
+            .uncompressed_size = entry.uncompressed_size,
+            .mtime = entry.mtime,
+            .filename_offset = (uintptr_t)filenames,
+            .crc_32 = cdh.crc_32,
+            .compression_method = cdh.compression_method,
+            .filename_length = length,
+        };
+        memcpy(filenames, strings, length + 1);
+        filenames += length + 1;
+    }
+
+    // resolve local headers to data offsets
+    for (size_t i = 0; i < cd.num_entries && !err; ++i) {
+        struct local_file_header lfh;
+        if (!(zip_io_seek(stream, entries[i].data_offset, SEEK_SET) == 0 &&
+              zip_io_read(&lfh, sizeof(lfh), 1, stream) &&
+              lfh.signature == 0x04034B50)) {
+            err = 1;
+            break;
+        }
+        entries[i].data_offset += sizeof(lfh) + lfh.file_name_length + lfh.extra_field_length;
+    }
+
+    if (!err) {
+        qsort(entries, cd.num_entries, sizeof(*entries), zip_index_compare);
+        for (size_t i = 0; i < cd.num_entries; ++i)
+            entries[i].filename_offset -= (uintptr_t)index;
+        index->index_size = filenames - (char *)index;
+
+        FILE *fp = fopen(path, "wb");
+        err = !(fp && fwrite(index, index->index_size, 1, fp));
+        if (fp && fclose(fp))
+            err = 1;
+    }
+
+    zip_free(allocator, strings);
+    zip_free(allocator, index);
+    return err;
+}
+
+const struct zip_index *zip_index_open(FILE *stream, const char *path) {
+    struct zip_index header;
+    if (zip_index_stamp(&header, stream))
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct zip_index))
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    const struct zip_index *index = (const struct zip_index *)addr;
+    int valid = index->signature == ZIP_INDEX_SIGNATURE &&
+                index->version == ZIP_INDEX_VERSION &&
+                index->index_size == (uint64_t)st.st_size &&
+                index->archive_size == header.archive_size &&
+                index->archive_mtime == header.archive_mtime &&
+                index->eocdr_crc_32 == header.eocdr_crc_32 &&
+                index->num_entries == header.num_entries &&
+                index->num_entries <= (index->index_size - sizeof(*index)) / sizeof(struct zip_index_entry);
+
+    // matching stamp doesn't make a damaged sidecar safe, every filename has to be terminated inside string area
+    const struct zip_index_entry *entries = zip_index_entries(index);
+    uint64_t strings_offset = valid ? sizeof(*index) + index->num_entries * sizeof(*entries) : 0;
+    for (uint64_t i = 0; valid && i < index->num_entries; ++i) {
+        uint64_t offset = entries[i].filename_offset;
+        valid = offset >= strings_offset &&
+                offset < index->index_size &&
+                entries[i].filename_length < index->index_size - offset &&
+                zip_index_filename(index, entries + i)[entries[i].filename_length] == '\0';
+    }
+    if (!valid) {
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+    return index;
+}
+
+void zip_index_close(const struct zip_index *index) {
+    if (index)
+        munmap((void *)index, index->index_size);
+}
+
+const struct zip_index_entry *zip_index_find(const struct zip_index *index, const char *filename) {
+    const struct zip_index_entry *entries = zip_index_entries(index);
+    size_t lo = 0, hi = index->num_entries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(zip_index_filename(index, entries + mid), filename);
+        if (cmp == 0)
+            return entries + mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+int zip_index_seek(FILE *stream, const struct zip_index_entry *entry) {
+    return zip_io_seek(stream, entry->data_offset, SEEK_SET) != 0;
+}
+
+#define ZIP_OVERLAY_EMPTY UINT32_MAX
+#define ZIP_OVERLAY_REMOVED (UINT32_MAX - 1)
+
+struct zip_overlay_layer {
+    FILE *stream;
+    struct zip_entry *entries; // NULL for removed layer
+    size_t num_entries;
+};
+
+// one archive's entry for a path, refs of the same path are chained newest first
+struct zip_overlay_ref {
+    const struct zip_entry *entry;
+    uint32_t layer;
+    uint32_t next;
+};
+
+// open addressing slot, head is ref index or one of the markers above
+struct zip_overlay_slot {
+    uint64_t hash;
+    uint32_t head;
+};
+
+struct zip_overlay {
+    struct zip_allocator allocator;
+    struct zip_overlay_layer *layers;
+    size_t num_layers;
+    size_t max_layers;
+    struct zip_overlay_ref *refs;
+    uint32_t num_refs;
+    uint32_t max_refs;
+    uint32_t free_ref;
+    struct zip_overlay_slot *slots;
+    size_t mask;
+    size_t num_used; // live and removed slots, both lengthen probes
+};
+
+static uint64_t zip_overlay_hash(const char *filename) {
+    // FNV-1a
+    uint64_t h = 0xCBF29CE484222325;
+    while (*filename)
+        h = (h ^ (uint8_t)*filename++) * 0x100000001B3;
+    return h;
+}
+
+static struct zip_overlay_slot *zip_overlay_slot(const struct zip_overlay *overlay, const char *filename, uint64_t hash) {
+    // live slot of filename, or first free slot of its probe sequence
+    struct zip_overlay_slot *removed = NULL;
+    for (size_t i = hash & overlay->mask;; i = (i + 1) & overlay->mask) {
+        struct zip_overlay_slot *slot = overlay->slots + i;
+        if (slot->head == ZIP_OVERLAY_EMPTY)
+            return removed ? removed : slot;
+        if (slot->head == ZIP_OVERLAY_REMOVED) {
+            if (!removed)
+                removed = slot;
+        } else if (slot->hash == hash && !strcmp(overlay->refs[slot->head].entry->filename, filename)) {
+            return slot;
+        }
+    }
+}
+
+// grow to fit more entries, so pushing a layer can't fail halfway
+static int zip_overlay_reserve(struct zip_overlay *overlay, size_t num_entries) {
+    if (overlay->num_refs + num_entries >= ZIP_OVERLAY_REMOVED)
+        return 1;
+    size_t max_refs = overlay->max_refs ? overlay->max_refs : 256;
+    while (max_refs < overlay->num_refs + num_entries)
+        max_refs *= 2;
+    if (max_refs != overlay->max_refs) {
+        struct zip_overlay_ref *refs = (struct zip_overlay_ref *)zip_malloc(&overlay->allocator, max_refs * sizeof(*refs));
+        if (!refs)
+            return 1;
+        if (overlay->num_refs)
+            memcpy(refs, overlay->refs, overlay->num_refs * sizeof(*refs));
+        zip_free(&overlay->allocator, overlay->refs);
+        overlay->refs = refs;
+        overlay->max_refs = max_refs;
+    }
+
+    // keep load under half, rehash drops removed slots
+    size_t capacity = overlay->mask + 1;
+    if ((overlay->num_used + num_entries) * 2 < capacity)
+        return 0;
+    size_t num_live = 0;
+    for (size_t i = 0; i < capacity; ++i)
+        num_live += overlay->slots[i].head < ZIP_OVERLAY_REMOVED;
+    while ((num_live + num_entries) * 2 >= capacity)
+        capacity *= 2;
+    struct zip_overlay_slot *slots = (struct zip_overlay_slot *)zip_malloc(&overlay->allocator, capacity * sizeof(*slots));
+    if (!slots)
+        return 1;
+    for (size_t i = 0; i < capacity; ++i)
+        slots[i].head = ZIP_OVERLAY_EMPTY;
+    for (size_t i = 0; i <= overlay->mask; ++i) {
+        struct zip_overlay_slot slot = overlay->slots[i];
+        if (slot.head >= ZIP_OVERLAY_REMOVED)
+            continue;
+        size_t k = slot.hash & (capacity - 1);
+        while (slots[k].head != ZIP_OVERLAY_EMPTY)
+            k = (k + 1) & (capacity - 1);
+        slots[k] = slot;
+    }
+    zip_free(&overlay->allocator, overlay->slots);
+    overlay->slots = slots;
+    overlay->mask = capacity - 1;
+    overlay->num_used = num_live;
+    return 0;
+}
+
+struct zip_overlay *zip_overlay_create(const struct zip_allocator *allocator) {
+    allocator = zip_allocator_or_default(allocator);
+    struct zip_overlay *overlay = (struct zip_overlay *)zip_malloc(allocator, sizeof(*overlay));
+    if (!overlay)
+        return NULL;
+    memset(overlay, 0, sizeof(*overlay));
+    overlay->allocator = *allocator;
+    overlay->free_ref = ZIP_OVERLAY_EMPTY;
+    overlay->mask = 15;
+    overlay->slots = (struct zip_overlay_slot *)zip_malloc(allocator, (overlay->mask + 1) * sizeof(*overlay->slots));
+    if (!overlay->slots) {
+        zip_free(allocator, overlay);
+        return NULL;
+    }
+    for (size_t i = 0; i <= overlay->mask; ++i)
+        overlay->slots[i].head = ZIP_OVERLAY_EMPTY;
+    return overlay;
+}
+
+void zip_overlay_destroy(struct zip_overlay *overlay) {
+    if (!overlay)
+        return;
+    for (size_t i = 0; i < overlay->num_layers; ++i)
+        zip_free(&overlay->allocator, overlay->layers[i].entries);
+    zip_free(&overlay->allocator, overlay->layers);
+    zip_free(&overlay->allocator, overlay->refs);
+    zip_free(&overlay->allocator, overlay->slots);
+    struct zip_allocator allocator = overlay->allocator;
+    zip_free(&allocator, overlay);
+}
+
+int zip_overlay_push(struct zip_overlay *overlay, FILE *stream) {
+    // reuse id of removed layer, chains are ordered by push time, not by id
+    size_t id = 0;
+    while (id < overlay->num_layers && overlay->layers[id].entries)
+        ++id;
+    if (id == overlay->max_layers) {
+        size_t max_layers = overlay->max_layers ? overlay->max_layers * 2 : 8;
+        struct zip_overlay_layer *layers =
+            (struct zip_overlay_layer *)zip_malloc(&overlay->allocator, max_layers * sizeof(*layers));
+        if (!layers)
+            return -1;
+        if (overlay->num_layers)
+            memcpy(layers, overlay->layers, overlay->num_layers * sizeof(*layers));
+        zip_free(&overlay->allocator, overlay->layers);
+        overlay->layers = layers;
+        overlay->max_layers = max_layers;
+    }
+    if (id > INT32_MAX)
+        return -1;
+
+    size_t size = zip_read_size(stream);
+    struct zip_entry *entries = size ? (struct zip_entry *)zip_malloc(&overlay->allocator, size) : NULL;
+    size_t num_entries = entries ? zip_read_into(entries, size, stream) : 0;
+    if (!(num_entries && zip_overlay_reserve(overlay, num_entries) == 0)) {
+        zip_free(&overlay->allocator, entries);
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_entries; ++i) {
+        uint32_t ref = overlay->free_ref;
+        if (ref != ZIP_OVERLAY_EMPTY)
+            overlay->free_ref = overlay->refs[ref].next;
+        else
+            ref = overlay->num_refs++;
+        uint64_t hash = zip_overlay_hash(entries[i].filename);
+        struct zip_overlay_slot *slot = zip_overlay_slot(overlay, entries[i].filename, hash);
+        if (slot->head == ZIP_OVERLAY_EMPTY)
+            ++overlay->num_used;
+        overlay->refs[ref] = (struct zip_overlay_ref){entries + i, id, slot->head < ZIP_OVERLAY_REMOVED ? slot->head : ZIP_OVERLAY_EMPTY};
+        slot->hash = hash;
+        slot->head = ref;
+    }
+
+    overlay->layers[id] = (struct zip_overlay_layer){stream, entries, num_entries};
+    if (id == overlay->num_layers)
+        ++overlay->num_layers;
+    return (int)id;
+}
+
+int zip_overlay_remove(struct zip_overlay *overlay, int layer) {
+    if (!(layer >= 0 && (size_t)layer < overlay->num_layers && overlay->layers[layer].entries))
+        return 1;
+
+    // unlink one ref per entry, work is proportional to removed layer only
+    struct zip_overlay_layer *l = overlay->layers + layer;
+    for (size_t i = 0; i < l->num_entries; ++i) {
+        struct zip_overlay_slot *slot = zip_overlay_slot(overlay, l->entries[i].filename, zip_overlay_hash(l->entries[i].filename));
+        uint32_t *p = &slot->head;
+        while (overlay->refs[*p].entry != l->entries + i)
+            p = &overlay->refs[*p].next;
+        uint32_t ref = *p;
+        *p = overlay->refs[ref].next;
+        overlay->refs[ref].next = overlay->free_ref;
+        overlay->free_ref = ref;
+        if (slot->head == ZIP_OVERLAY_EMPTY)
+            slot->head = ZIP_OVERLAY_REMOVED;
+    }
+
+    zip_free(&overlay->allocator, l->entries);
+    l->entries = NULL;
+    l->num_entries = 0;
+    while (overlay->num_layers && !overlay->layers[overlay->num_layers - 1].entries)
+        --overlay->num_layers;
+    return 0;
+}
+
+const struct zip_entry *zip_overlay_find(const struct zip_overlay *overlay, const char *filename, FILE **stream) {
+    const struct zip_overlay_slot *slot = zip_overlay_slot(overlay, filename, zip_overlay_hash(filename));
+    if (slot->head >= ZIP_OVERLAY_REMOVED)
+        return NULL;
+    const struct zip_overlay_ref *ref = overlay->refs + slot->head;
+    if (stream)
+        *stream = overlay->layers[ref->layer].stream;
+    return ref->entry;
+}
+
+#define ZIP_CHUNK_SIZE (1 << 15) // inflate window, every flush but the last one is a full chunk
+#define ZIP_CACHE_BUCKETS 4096
+#define ZIP_PREFETCH_CHUNKS 4
+
+struct zip_chunk {
+    FILE *stream;
+    uint64_t entry_offset;
+    uint64_t index;
+    size_t size;
+    struct zip_chunk *hash_next;
+    struct zip_chunk *lru_prev;
+    struct zip_chunk *lru_next;
+    uint8_t data[];
+};
+
+// entry being decoded, readers of its chunks wait instead of decoding it again
+struct zip_decode {
+    FILE *stream;
+    uint64_t entry_offset;
+    uint64_t last_chunk;
+    struct zip_decode *next;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+    struct zip_chunk *buckets[ZIP_CACHE_BUCKETS];
+    struct zip_chunk *lru_head;
+    struct zip_chunk *lru_tail;
+    struct zip_decode *decodes;
+    struct zip_cache_stats stats;
+    struct zip_allocator allocator;
+    struct zip_pool *pool;
+} zip_cache = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {0}, NULL, NULL, NULL, {.limit = 64 << 20},
+               {zip_default_malloc, zip_default_free, NULL}, NULL};
+
+#define ZIP_CACHE_LINE 64
+
+struct zip_pool {
+    struct zip_allocator allocator;
+    pthread_mutex_t mutex;
+    pthread_cond_t released;
+    size_t slab_size;
+    size_t num_free;
+    void **free_slabs;
+};
+
+struct zip_file {
+    FILE *stream;
+    uint64_t entry_offset;
+    uint64_t data_offset;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint16_t compression_method;
+    uint64_t position;
+    uint64_t chunk_index; // UINT64_MAX when chunk is empty
+    size_t chunk_size;
+    struct zip_allocator allocator;
+    uint8_t chunk[ZIP_CHUNK_SIZE];
+};
+
+static struct zip_chunk **zip_cache_bucket(FILE *stream, uint64_t entry_offset, uint64_t index) {
+    uint64_t h = ((uint64_t)(uintptr_t)stream ^ entry_offset * 0x9E3779B97F4A7C15 ^ index * 0xC2B2AE3D27D4EB4F);
+    h ^= h >> 29;
+    return zip_cache.buckets + h % ZIP_CACHE_BUCKETS;
+}
+
+static void zip_cache_unlink_lru(struct zip_chunk *chunk) {
+    *(chunk->lru_prev ? &chunk->lru_prev->lru_next : &zip_cache.lru_head) = chunk->lru_next;
+    *(chunk->lru_next ? &chunk->lru_next->lru_prev : &zip_cache.lru_tail) = chunk->lru_prev;
+}
+
+static void zip_cache_push_lru(struct zip_chunk *chunk) {
+    chunk->lru_prev = NULL;
+    chunk->lru_next = zip_cache.lru_head;
+    *(zip_cache.lru_head ? &zip_cache.lru_head->lru_prev : &zip_cache.lru_tail) = chunk;
+    zip_cache.lru_head = chunk;
+}
+
+static void zip_cache_remove(struct zip_chunk *chunk) {
+    struct zip_chunk **p = zip_cache_bucket(chunk->stream, chunk->entry_offset, chunk->index);
+    while (*p != chunk)
+        p = &(*p)->hash_next;
+    *p = chunk->hash_next;
+    zip_cache_unlink_lru(chunk);
+    zip_cache.stats.size -= sizeof(*chunk) + chunk->size;
+    zip_free(&zip_cache.allocator, chunk);
+}
+
+static void zip_cache_evict(void) {
+    while (zip_cache.stats.size > zip_cache.stats.limit && zip_cache.lru_tail) {
+        zip_cache_remove(zip_cache.lru_tail);
+        zip_cache.stats.evictions++;
+    }
+}
+
+static struct zip_chunk *zip_cache_find(FILE *stream, uint64_t entry_offset, uint64_t index) {
+    struct zip_chunk *chunk = *zip_cache_bucket(stream, entry_offset, index);
+    while (chunk && !(chunk->stream == stream && chunk->entry_offset == entry_offset && chunk->index == index))
+        chunk = chunk->hash_next;
+    return chunk;
+}
+
+static void zip_cache_insert(FILE *stream, uint64_t entry_offset, uint64_t index, const void *data, size_t size) {
+    if (zip_cache_find(stream, entry_offset, index))
+        return;
+    struct zip_chunk *chunk = (struct zip_chunk *)zip_malloc(&zip_cache.allocator, sizeof(*chunk) + size);
+    if (!chunk)
+        return;
+    chunk->stream = stream;
+    chunk->entry_offset = entry_offset;
+    chunk->index = index;
+    chunk->size = size;
+    memcpy(chunk->data, data, size);
+    struct zip_chunk **bucket = zip_cache_bucket(stream, entry_offset, index);
+    chunk->hash_next = *bucket;
+    *bucket = chunk;
+    zip_cache_push_lru(chunk);
+    zip_cache.stats.size += sizeof(*chunk) + size;
+    zip_cache_evict();
+}
+
+void zip_cache_limit(size_t size) {
+    pthread_mutex_lock(&zip_cache.mutex);
+    zip_cache.stats.limit = size;
+    zip_cache_evict();
+    pthread_mutex_unlock(&zip_cache.mutex);
+}
+
+void zip_cache_purge(FILE *stream) {
+    pthread_mutex_lock(&zip_cache.mutex);
+    for (struct zip_chunk *chunk = zip_cache.lru_head, *next; chunk; chunk = next) {
+        next = chunk->lru_next;
+        if (chunk->stream == stream)
+            zip_cache_remove(chunk);
+    }
+    pthread_mutex_unlock(&zip_cache.mutex);
+}
+
+void zip_cache_set_allocator(const struct zip_allocator *allocator) {
+    pthread_mutex_lock(&zip_cache.mutex);
+    while (zip_cache.lru_tail)
+        zip_cache_remove(zip_cache.lru_tail);
+    zip_cache.allocator = *zip_allocator_or_default(allocator);
+    pthread_mutex_unlock(&zip_cache.mutex);
+}
+
+int zip_cache_set_pool(struct zip_pool *pool) {
+    if (pool && pool->slab_size < ZIP_DECODER_SIZE)
+        return 1;
+    pthread_mutex_lock(&zip_cache.mutex);
+    zip_cache.pool = pool;
+    pthread_mutex_unlock(&zip_cache.mutex);
+    return 0;
+}
+
+void zip_cache_get_stats(struct zip_cache_stats *stats) {
+    pthread_mutex_lock(&zip_cache.mutex);
+    *stats = zip_cache.stats;
+    pthread_mutex_unlock(&zip_cache.mutex);
+}
+
+// reads compressed data at its own offset so handles can share stream
+static int zip_file_pread(struct zip_file *file, void *ptr, size_t size, uint64_t offset) {
+    flockfile(file->stream);
+    int ok = zip_io_seek(file->stream, offset, SEEK_SET) == 0 && zip_io_read(ptr, size, 1, file->stream);
+    funlockfile(file->stream);
+    return !ok;
+}
+
+struct zip_file_decoder {
+    struct zip_file *file;
+    uint64_t input_offset;
+    uint64_t input_remaining;
+    uint64_t chunk;
+    uint64_t last_chunk;
+    int found;
+    uint8_t input[BUFSIZ];
+};
+
+// all state of one inflate, lives on the stack or in a pool slab
+struct zip_decoder {
+    struct stbi__stream stream;
+    struct zip_file_decoder d;
+    uint8_t window[ZIP_CHUNK_SIZE];
+};
+
+typedef char zip_decoder_size_check[sizeof(struct zip_decoder) <= ZIP_DECODER_SIZE ? 1 : -1];
+
+static int zip_file_refill(struct stbi__stream *stream) {
+    struct zip_file_decoder *d = (struct zip_file_decoder *)stream->cookie_in;
+    size_t n = d->input_remaining < sizeof(d->input) ? d->input_remaining : sizeof(d->input);
+    if (n == 0 || zip_file_pread(d->file, d->input, n, d->input_offset))
+        return refill_zeros(stream);
+    d->input_offset += n;
+    d->input_remaining -= n;
+    stream->start_in = stream->next_in = d->input;
+    stream->end_in = d->input + n;
+    return 0;
+}
+
+static int zip_file_flush(struct stbi__stream *stream) {
+    struct zip_file_decoder *d = (struct zip_file_decoder *)stream->cookie_out;
+    size_t size = stream->next_out - stream->start_out;
+    if (size == 0)
+        return 0;
+    struct zip_file *file = d->file;
+    pthread_mutex_lock(&zip_cache.mutex);
+    zip_cache_insert(file->stream, file->entry_offset, d->chunk, stream->start_out, size);
+    pthread_mutex_unlock(&zip_cache.mutex);
+    if (d->chunk == file->chunk_index) {
+        memcpy(file->chunk, stream->start_out, size);
+        file->chunk_size = size;
+        d->found = 1;
+    }
+    stream->next_out = stream->start_out;
+    // nonzero stops decoding
+    return d->chunk++ == d->last_chunk;
+}
+
+// inflate entry from the start up to last_chunk, caching every chunk on the way
+static int zip_file_inflate(struct zip_decoder *decoder, struct zip_file *file, uint64_t last_chunk) {
+    struct zip_file_decoder *d = &decoder->d;
+    d->file = file;
+    d->input_offset = file->data_offset;
+    d->input_remaining = file->compressed_size;
+    d->chunk = 0;
+    d->last_chunk = last_chunk;
+    d->found = 0;
+
+    struct stbi__stream *stream = &decoder->stream;
+    memset(stream, 0, sizeof(*stream));
+    stream->start_in = stream->next_in = stream->end_in = d->input;
+    stream->cookie_in = d;
+    stream->refill = zip_file_refill;
+
+    stream->start_out = stream->next_out = decoder->window;
+    stream->end_out = decoder->window + sizeof(decoder->window);
+    stream->cookie_out = d;
+    stream->flush = zip_file_flush;
+
+    stb_inflate(stream);
+    return !d->found;
+}
+
+static int zip_file_decode(struct zip_file *file, uint64_t last_chunk, struct zip_pool *pool) {
+    if (!pool) {
+        struct zip_decoder decoder;
+        return zip_file_inflate(&decoder, file, last_chunk);
+    }
+    struct zip_decoder *decoder = (struct zip_decoder *)zip_pool_acquire(pool);
+    int err = zip_file_inflate(decoder, file, last_chunk);
+    zip_pool_release(pool, decoder);
+    return err;
+}
+
+static struct zip_decode *zip_cache_find_decode(FILE *stream, uint64_t entry_offset) {
+    struct zip_decode *decode = zip_cache.decodes;
+    while (decode && !(decode->stream == stream && decode->entry_offset == entry_offset))
+        decode = decode->next;
+    return decode;
+}
+
+static int zip_file_load(struct zip_file *file, uint64_t index) {
+    uint64_t previous = file->chunk_index;
+    file->chunk_index = index;
+
+    if (file->compression_method == 0) {
+        uint64_t offset = index * ZIP_CHUNK_SIZE;
+        file->chunk_size = file->uncompressed_size - offset < ZIP_CHUNK_SIZE ? file->uncompressed_size - offset : ZIP_CHUNK_SIZE;
+        if (zip_file_pread(file, file->chunk, file->chunk_size, file->data_offset + offset)) {
+            file->chunk_index = UINT64_MAX;
+            return 1;
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&zip_cache.mutex);
+    int waited = 0;
+    for (;;) {
+        struct zip_chunk *chunk = zip_cache_find(file->stream, file->entry_offset, index);
+        if (chunk) {
+            zip_cache_unlink_lru(chunk);
+            zip_cache_push_lru(chunk);
+            memcpy(file->chunk, chunk->data, chunk->size);
+            file->chunk_size = chunk->size;
+            zip_cache.stats.hits++;
+            zip_cache.stats.shared += waited;
+            pthread_mutex_unlock(&zip_cache.mutex);
+            return 0;
+        }
+        struct zip_decode *decode = zip_cache_find_decode(file->stream, file->entry_offset);
+        if (!(decode && decode->last_chunk >= index))
+            break;
+        pthread_cond_wait(&zip_cache.done, &zip_cache.mutex);
+        waited = 1;
+    }
+    zip_cache.stats.misses++;
+
+    // sequential readers decode ahead, doubling the distance keeps total work linear in entry size
+    uint64_t ahead = ZIP_PREFETCH_CHUNKS;
+    if (previous != UINT64_MAX && previous + 1 == index && index > ahead)
+        ahead = index;
+    if (ahead > zip_cache.stats.limit / 2 / ZIP_CHUNK_SIZE)
+        ahead = zip_cache.stats.limit / 2 / ZIP_CHUNK_SIZE;
+
+    struct zip_decode decode = {file->stream, file->entry_offset, index + ahead, zip_cache.decodes};
+    zip_cache.decodes = &decode;
+    struct zip_pool *pool = zip_cache.pool;
+    pthread_mutex_unlock(&zip_cache.mutex);
+
+    int err = zip_file_decode(file, decode.last_chunk, pool);
+
+    pthread_mutex_lock(&zip_cache.mutex);
+    struct zip_decode **p = &zip_cache.decodes;
+    while (*p != &decode)
+        p = &(*p)->next;
+    *p = decode.next;
+    pthread_cond_broadcast(&zip_cache.done);
+    pthread_mutex_unlock(&zip_cache.mutex);
+
+    if (err)
+        file->chunk_index = UINT64_MAX;
+    return err;
+}
+
+struct zip_file *zip_fopen(FILE *stream, const struct zip_entry *entry, const struct zip_allocator *allocator) {
+    allocator = zip_allocator_or_default(allocator);
+    struct zip_file *file = (struct zip_file *)zip_malloc(allocator, sizeof(*file));
+    if (!file)
+        return NULL;
+    file->stream = stream;
+    file->allocator = *allocator;
+
+    struct local_file_header lfh;
+    if (!(zip_file_pread(file, &lfh, sizeof(lfh), entry->local_header_offset) == 0 &&
+          lfh.signature == 0x04034B50 &&
+          (lfh.compression_method == 0 || lfh.compression_method == 8))) {
+        zip_free(allocator, file);
+        return NULL;
+    }
+
+    file->entry_offset = entry->local_header_offset;
+    file->data_offset = entry->local_header_offset + sizeof(lfh) + lfh.file_name_length + lfh.extra_field_length;
+    file->compressed_size = entry->compressed_size;
+    file->uncompressed_size = entry->uncompressed_size;
+    file->compression_method = lfh.compression_method;
+    file->position = 0;
+    file->chunk_index = UINT64_MAX;
+    file->chunk_size = 0;
+    return file;
+}
+
+size_t zip_fread(void *ptr, size_t size, struct zip_file *file) {
+    size_t total = 0;
+    while (total < size && file->position < file->uncompressed_size) {
+        uint64_t index = file->position / ZIP_CHUNK_SIZE;
+        if (index != file->chunk_index && zip_file_load(file, index))
+            break;
+        size_t offset = file->position % ZIP_CHUNK_SIZE;
+        if (offset >= file->chunk_size)
+            break;
+        size_t n = file->chunk_size - offset < size - total ? file->chunk_size - offset : size - total;
+        memcpy((uint8_t *)ptr + total, file->chunk + offset, n);
+        total += n;
+        file->position += n;
+    }
+    return total;
+}
+
+int zip_fseek(struct zip_file *file, int64_t offset, int whence) {
+    int64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (int64_t)file->position : (int64_t)file->uncompressed_size;
+    if (!(whence == SEEK_SET || whence == SEEK_CUR || whence == SEEK_END) ||
+        base + offset < 0 || (uint64_t)(base + offset) > file->uncompressed_size)
+        return -1;
+    file->position = base + offset;
+    return 0;
+}
+
+uint64_t zip_ftell(const struct zip_file *file) {
+    return file->position;
+}
+
+void zip_fclose(struct zip_file *file) {
+    zip_free(&file->allocator, file);
+}
+
+struct zip_pool *zip_pool_create(size_t slab_size, size_t num_slabs, const struct zip_allocator *allocator) {
+    // header, free stack and slabs in one block, slabs rounded up to whole cache lines
+    allocator = zip_allocator_or_default(allocator);
+    slab_size = (slab_size + ZIP_CACHE_LINE - 1) & ~(size_t)(ZIP_CACHE_LINE - 1);
+    size_t header_size = sizeof(struct zip_pool) + num_slabs * sizeof(void *);
+    struct zip_pool *pool = (struct zip_pool *)zip_malloc(allocator, header_size + ZIP_CACHE_LINE - 1 + num_slabs * slab_size);
+    if (!(num_slabs && pool)) {
+        zip_free(allocator, pool);
+        return NULL;
+    }
+    pool->allocator = *allocator;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->released, NULL);
+    pool->slab_size = slab_size;
+    pool->num_free = num_slabs;
+    pool->free_slabs = (void **)(pool + 1);
+
+    uintptr_t slabs = ((uintptr_t)pool + header_size + ZIP_CACHE_LINE - 1) & ~(uintptr_t)(ZIP_CACHE_LINE - 1);
+    for (size_t i = 0; i < num_slabs; ++i)
+        pool->free_slabs[i] = (void *)(slabs + i * slab_size);
+    return pool;
+}
+
+void zip_pool_destroy(struct zip_pool *pool) {
+    if (!pool)
+        return;
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->released);
+    struct zip_allocator allocator = pool->allocator;
+    zip_free(&allocator, pool);
+}
+
+void *zip_pool_acquire(struct zip_pool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->num_free == 0)
+        pthread_cond_wait(&pool->released, &pool->mutex);
+    void *slab = pool->free_slabs[--pool->num_free];
+    pthread_mutex_unlock(&pool->mutex);
+    return slab;
+}
+
+void zip_pool_release(struct zip_pool *pool, void *slab) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->free_slabs[pool->num_free++] = slab;
+    pthread_cond_signal(&pool->released);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+#ifdef NOZIP_ZLIB
+// small entries stay on stb, which needs no heap while inflateInit2 takes about 40 KB of zlib state per entry,
+// nozip_bench codec group measured both within 10% below this size on x86-64
+static uint64_t zip_zlib_threshold = 1 << 12;
+#endif
+static struct stbi__stats *zip_inflate_stats;
+
+void zip_codec_threshold(uint64_t size) {
+#ifdef NOZIP_ZLIB
+    zip_zlib_threshold = size;
+#endif
+}
+
+enum zip_codec zip_codec_select(const struct zip_entry *entry, enum zip_codec codec) {
+#ifdef NOZIP_ZLIB
+    if (codec == ZIP_CODEC_AUTO)
+        codec = entry->uncompressed_size >= zip_zlib_threshold ? ZIP_CODEC_ZLIB : ZIP_CODEC_STB;
+    return codec;
+#else
+    return ZIP_CODEC_STB;
+#endif
+}
+
+void zip_set_inflate_stats(struct stbi__stats *stats) {
+    __atomic_store_n(&zip_inflate_stats, stats, __ATOMIC_RELEASE);
+}
+
+// add counters of one zip_extract to shared ones, other threads may be adding theirs
+static void zip_inflate_stats_merge(struct stbi__stats *to, const struct stbi__stats *from) {
+    for (int i = 0; i < 3; ++i)
+        zip_atomic_add(&to->blocks[i], from->blocks[i]);
+    zip_atomic_add(&to->huffman_builds, from->huffman_builds);
+    zip_atomic_add(&to->decodes, from->decodes);
+    zip_atomic_add(&to->slow_decodes, from->slow_decodes);
+    zip_atomic_add(&to->literals, from->literals);
+    zip_atomic_add(&to->matches, from->matches);
+    zip_atomic_add(&to->match_length, from->match_length);
+    zip_atomic_add(&to->match_distance, from->match_distance);
+    zip_atomic_add(&to->refills, from->refills);
+    zip_atomic_add(&to->refill_bytes, from->refill_bytes);
+    zip_atomic_add(&to->flushes, from->flushes);
+    zip_atomic_add(&to->flush_bytes, from->flush_bytes);
+    zip_atomic_add_seconds(&to->io_seconds, from->io_seconds);
+    zip_atomic_add_seconds(&to->total_seconds, from->total_seconds);
+}
+
+// all state of one zip_extract, lives on the stack or in a pool slab like zip_decoder
+struct zip_extract_state {
+    FILE *stream;
+    uint64_t input_remaining;
+    uint64_t output_size;
+    int (*write)(const void *data, size_t size, void *user);
+    void *user;
+    const struct zip_allocator *allocator;
+    int err;
+    struct stbi__stats *stats; // this call's counters, merged into zip_inflate_stats at the end, NULL when off
+    struct stbi__stats call_stats;
+    struct stbi__stream inflate;
+    uint8_t window[ZIP_CHUNK_SIZE]; // stb window or zlib output
+    uint8_t input[BUFSIZ];
+};
+
+typedef char zip_extract_state_size_check[sizeof(struct zip_extract_state) <= ZIP_DECODER_SIZE ? 1 : -1];
+
+static int zip_extract_refill(struct stbi__stream *stream) {
+    struct zip_extract_state *x = (struct zip_extract_state *)stream->cookie_in;
+    size_t n = x->input_remaining < sizeof(x->input) ? x->input_remaining : sizeof(x->input);
+    if (n == 0 || !zip_io_read(x->input, n, 1, x->stream))
+        return refill_zeros(stream);
+    x->input_remaining -= n;
+    stream->start_in = stream->next_in = x->input;
+    stream->end_in = x->input + n;
+    return 0;
+}
+
+static int zip_extract_flush(struct stbi__stream *stream) {
+    struct zip_extract_state *x = (struct zip_extract_state *)stream->cookie_out;
+    size_t size = stream->next_out - stream->start_out;
+    if (size && x->write(stream->start_out, size, x->user)) {
+        x->err = 1;
+        return 1;
+    }
+    x->output_size += size;
+    stream->next_out = stream->start_out;
+    return 0;
+}
+
+static int zip_extract_stb(struct zip_extract_state *x) {
+    // huffman tables are built by every block before use, clearing them would dominate small entries
+    struct stbi__stream *stream = &x->inflate;
+    stream->start_in = stream->next_in = stream->end_in = x->input;
+    stream->cookie_in = x;
+    stream->refill = zip_extract_refill;
+    stream->start_out = stream->next_out = x->window;
+    stream->end_out = x->window + sizeof(x->window);
+    stream->cookie_out = x;
+    stream->flush = zip_extract_flush;
+    stream->total_in = stream->total_out = 0;
+    stream->stats = x->stats;
+
+    return !stb_inflate(stream) || x->err;
+}
+
+#ifdef NOZIP_ZLIB
+static voidpf zip_zlib_alloc(voidpf opaque, uInt items, uInt size) {
+    return size && items > SIZE_MAX / size ? Z_NULL : zip_malloc((const struct zip_allocator *)opaque, (size_t)items * size);
+}
+
+static void zip_zlib_free(voidpf opaque, voidpf ptr) {
+    zip_free((const struct zip_allocator *)opaque, ptr);
+}
+
+// same counters stb fills where they have a zlib meaning, huffman ones stay untouched
+static int zip_extract_zlib(struct zip_extract_state *x) {
+    struct stbi__stats *stats = x->stats;
+    double start = stats ? zip_now() : 0;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.zalloc = zip_zlib_alloc;
+    stream.zfree = zip_zlib_free;
+    stream.opaque = (voidpf)x->allocator;
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return 1;
+
+    int ret = Z_OK;
+    while (ret == Z_OK && !x->err) {
+        if (stream.avail_in == 0 && x->input_remaining) {
+            size_t n = x->input_remaining < sizeof(x->input) ? x->input_remaining : sizeof(x->input);
+            double t = stats ? zip_now() : 0;
+            if (!zip_io_read(x->input, n, 1, x->stream))
+                break;
+            if (stats) {
+                stats->io_seconds += zip_now() - t;
+                stats->refills++;
+                stats->refill_bytes += n;
+            }
+            x->input_remaining -= n;
+            stream.next_in = x->input;
+            stream.avail_in = n;
+        }
+        stream.next_out = x->window;
+        stream.avail_out = sizeof(x->window);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        size_t size = sizeof(x->window) - stream.avail_out;
+        if ((ret == Z_OK || ret == Z_STREAM_END) && size) {
+            double t = stats ? zip_now() : 0;
+            x->err = x->write(x->window, size, x->user);
+            if (stats) {
+                stats->io_seconds += zip_now() - t;
+                stats->flushes++;
+                stats->flush_bytes += size;
+            }
+        }
+        x->output_size += size;
+    }
+    inflateEnd(&stream);
+    if (stats)
+        stats->total_seconds += zip_now() - start;
+    return ret != Z_STREAM_END || x->err;
+}
+#endif
+
+static int zip_extract_data(struct zip_extract_state *x, const struct zip_entry *entry, uint16_t method, enum zip_codec codec) {
+    x->input_remaining = entry->compressed_size;
+    x->output_size = 0;
+    x->err = 0;
+    struct stbi__stats *shared_stats = __atomic_load_n(&zip_inflate_stats, __ATOMIC_ACQUIRE);
+    x->stats = shared_stats ? &x->call_stats : NULL;
+    if (shared_stats)
+        memset(&x->call_stats, 0, sizeof(x->call_stats));
+    int err;
+    if (method == 0) {
+        // stored data is copied through input buffer
+        err = 0;
+        while (!err && x->input_remaining) {
+            size_t n = x->input_remaining < sizeof(x->input) ? x->input_remaining : sizeof(x->input);
+            err = !zip_io_read(x->input, n, 1, x->stream) || x->write(x->input, n, x->user);
+            x->input_remaining -= n;
+            x->output_size += n;
+        }
+    } else if (method == 8) {
+        codec = zip_codec_select(entry, codec);
+#ifdef NOZIP_ZLIB
+        err = codec == ZIP_CODEC_ZLIB ? zip_extract_zlib(x) : zip_extract_stb(x);
+#else
+        err = zip_extract_stb(x);
+#endif
+    } else {
+        err = 1;
+    }
+    if (shared_stats)
+        zip_inflate_stats_merge(shared_stats, x->stats);
+    return err || x->output_size != entry->uncompressed_size;
+}
+
+int zip_extract(FILE *stream, const struct zip_entry *entry, int (*write)(const void *data, size_t size, void *user),
+                void *user, enum zip_codec codec, const struct zip_allocator *allocator) {
+    struct local_file_header lfh;
+    if (!(zip_io_seek(stream, entry->local_header_offset, SEEK_SET) == 0 &&
+          zip_io_read(&lfh, sizeof(lfh), 1, stream) &&
+          lfh.signature == 0x04034B50 &&
+          zip_io_seek(stream, lfh.file_name_length + lfh.extra_field_length, SEEK_CUR) == 0))
+        return 1;
+
+    // decoder state comes from the cache pool when one is set, same as zip_file_decode
+    pthread_mutex_lock(&zip_cache.mutex);
+    struct zip_pool *pool = zip_cache.pool;
+    pthread_mutex_unlock(&zip_cache.mutex);
+    if (!pool) {
+        struct zip_extract_state x;
+        x.stream = stream;
+        x.write = write;
+        x.user = user;
+        x.allocator = zip_allocator_or_default(allocator);
+        return zip_extract_data(&x, entry, lfh.compression_method, codec);
+    }
+    struct zip_extract_state *x = (struct zip_extract_state *)zip_pool_acquire(pool);
+    x->stream = stream;
+    x->write = write;
+    x->user = user;
+    x->allocator = zip_allocator_or_default(allocator);
+    int err = zip_extract_data(x, entry, lfh.compression_method, codec);
+    zip_pool_release(pool, x);
+    return err;
+}
+
+#define ZIP_TEST_BUFFER_SIZE (1 << 20)
+#define ZIP_TEST_BATCH_SIZE (4 << 20) // compressed bytes handed to a thread at once
+
+// sequential window over file, every refill is one large pread
+struct zip_test_reader {
+    int fd;
+    uint64_t file_size;
+    uint64_t offset; // file offset of buffer start
+    size_t length;
+    size_t position;
+    uint8_t *buffer;
+};
+
+static int zip_test_reader_seek(struct zip_test_reader *r, uint64_t offset) {
+    if (offset > r->file_size)
+        return 1;
+    if (offset >= r->offset && offset <= r->offset + r->length) {
+        r->position = offset - r->offset;
+    } else {
+        r->offset = offset;
+        r->length = r->position = 0;
+    }
+    return 0;
+}
+
+// at least one buffered byte after position, returns number of them, 0 at end of file or on error
+static size_t zip_test_reader_fill(struct zip_test_reader *r) {
+    if (r->position < r->length)
+        return r->length - r->position;
+    r->offset += r->length;
+    r->length = r->position = 0;
+    uint64_t remaining = r->file_size - r->offset;
+    size_t size = remaining < ZIP_TEST_BUFFER_SIZE ? remaining : ZIP_TEST_BUFFER_SIZE;
+    ssize_t n = 0;
+    // retry only interrupted reads, a persistent error ends the stream like eof
+    while (size && (n = pread(r->fd, r->buffer, size, r->offset)) < 0 && errno == EINTR)
+        ;
+    r->length = n > 0 ? n : 0;
+    return r->length;
+}
+
+static int zip_test_reader_read(struct zip_test_reader *r, void *ptr, size_t size) {
+    for (size_t n; size; size -= n) {
+        if (!zip_test_reader_fill(r))
+            return 1;
+        n = r->length - r->position < size ? r->length - r->position : size;
+        memcpy(ptr, r->buffer + r->position, n);
+        ptr = (uint8_t *)ptr + n;
+        r->position += n;
+    }
+    return 0;
+}
+
+struct zip_test_worker {
+    struct zip_test_reader reader;
+    uint64_t input_remaining;
+    uint64_t output_size;
+    uint64_t expected_size;
+    uint32_t crc_32;
+    struct zip_test_job *job;
+    struct stbi__stream stream;
+    uint8_t window[1 << 15];
+};
+
+struct zip_test_job {
+    const struct zip_table *table;
+    struct zip_test_result *results;
+    const size_t *order; // entries sorted by local header offset
+    const size_t *batches; // first position in order of every batch, plus end
+    size_t num_batches;
+    size_t next_batch;
+    pthread_mutex_t mutex;
+    struct zip_test_worker *workers;
+    long num_failed;
+};
+
+static int zip_test_refill(struct stbi__stream *stream) {
+    struct zip_test_worker *w = (struct zip_test_worker *)stream->cookie_in;
+    size_t n = w->input_remaining ? zip_test_reader_fill(&w->reader) : 0;
+    if (n == 0)
+        return refill_zeros(stream);
+    if (n > w->input_remaining)
+        n = w->input_remaining;
+    stream->start_in = stream->next_in = w->reader.buffer + w->reader.position;
+    stream->end_in = stream->start_in + n;
+    w->reader.position += n;
+    w->input_remaining -= n;
+    return 0;
+}
+
+static int zip_test_flush(struct stbi__stream *stream) {
+    struct zip_test_worker *w = (struct zip_test_worker *)stream->cookie_out;
+    size_t size = stream->next_out - stream->start_out;
+    w->crc_32 = zip_crc32(w->crc_32, stream->start_out, size);
+    w->output_size += size;
+    stream->next_out = stream->start_out;
+    // corrupt stream may decode forever, stop once it's too long
+    return w->output_size > w->expected_size;
+}
+
+static enum zip_test_error zip_test_entry(struct zip_test_worker *w, const struct zip_table *table, size_t i) {
+    struct zip_test_reader *r = &w->reader;
+    struct local_file_header lfh;
+    char filename[UINT16_MAX];
+    uint8_t extra[UINT16_MAX];
+    if (zip_test_reader_seek(r, table->local_header_offset[i]) || zip_test_reader_read(r, &lfh, sizeof(lfh)))
+        return ZIP_TEST_IO;
+    if (!(lfh.signature == 0x04034B50 &&
+          lfh.file_name_length == table->filename_length[i] &&
+          zip_test_reader_read(r, filename, lfh.file_name_length) == 0 &&
+          memcmp(filename, zip_table_filename(table, i), lfh.file_name_length) == 0 &&
+          zip_test_reader_read(r, extra, lfh.extra_field_length) == 0 &&
+          lfh.compression_method == table->compression_method[i]))
+        return ZIP_TEST_HEADER;
+
+    // sizes and crc follow data when bit 3 is set, zip64 sizes live in extra field
+    if (!(lfh.flags & 8)) {
+        uint64_t uncompressed_size = lfh.uncompressed_size;
+        uint64_t compressed_size = lfh.compressed_size;
+        for (size_t k = 0; k + 4 <= lfh.extra_field_length;) {
+            uint16_t id = extra[k] | extra[k + 1] << 8, size = extra[k + 2] | extra[k + 3] << 8;
+            if (id == 0x0001 && size >= 16 && k + 4 + size <= lfh.extra_field_length) {
+                memcpy(&uncompressed_size, extra + k + 4, 8);
+                memcpy(&compressed_size, extra + k + 12, 8);
+            }
+            k += 4 + size;
+        }
+        if (!(lfh.crc_32 == table->crc_32[i] &&
+              uncompressed_size == table->uncompressed_size[i] &&
+              compressed_size == table->compressed_size[i]))
+            return ZIP_TEST_HEADER;
+    }
+    if (r->offset + r->position + table->compressed_size[i] > r->file_size)
+        return ZIP_TEST_IO;
+
+    w->input_remaining = table->compressed_size[i];
+    w->output_size = 0;
+    w->expected_size = table->uncompressed_size[i];
+    w->crc_32 = 0;
+    if (lfh.compression_method == 0) {
+        if (table->compressed_size[i] != table->uncompressed_size[i])
+            return ZIP_TEST_SIZE;
+        for (size_t n; w->input_remaining; w->input_remaining -= n) {
+            if (!zip_test_reader_fill(r))
+                return ZIP_TEST_IO;
+            n = r->length - r->position < w->input_remaining ? r->length - r->position : w->input_remaining;
+            w->crc_32 = zip_crc32(w->crc_32, r->buffer + r->position, n);
+            r->position += n;
+        }
+        w->output_size = table->uncompressed_size[i];
+    } else if (lfh.compression_method == 8) {
+        struct stbi__stream *stream = &w->stream;
+        memset(stream, 0, sizeof(*stream));
+        stream->start_in = stream->next_in = stream->end_in = r->buffer;
+        stream->cookie_in = w;
+        stream->refill = zip_test_refill;
+        stream->start_out = stream->next_out = w->window;
+        stream->end_out = w->window + sizeof(w->window);
+        stream->cookie_out = w;
+        stream->flush = zip_test_flush;
+        if (!stb_inflate(stream))
+            return w->output_size > w->expected_size ? ZIP_TEST_SIZE : ZIP_TEST_DATA;
+    } else {
+        return ZIP_TEST_METHOD;
+    }
+
+    if (w->output_size != table->uncompressed_size[i])
+        return ZIP_TEST_SIZE;
+    return w->crc_32 == table->crc_32[i] ? ZIP_TEST_OK : ZIP_TEST_CRC;
+}
+
+static void *zip_test_run(void *arg) {
+    struct zip_test_worker *w = (struct zip_test_worker *)arg;
+    struct zip_test_job *job = w->job;
+    long num_failed = 0;
+    for (;;) {
+        pthread_mutex_lock(&job->mutex);
+        size_t batch = job->next_batch < job->num_batches ? job->next_batch++ : job->num_batches;
+        pthread_mutex_unlock(&job->mutex);
+        if (batch == job->num_batches)
+            break;
+        for (size_t k = job->batches[batch]; k < job->batches[batch + 1]; ++k) {
+            size_t i = job->order[k];
+            double t = zip_now();
+            job->results[i].error = zip_test_entry(w, job->table, i);
+            job->results[i].seconds = zip_now() - t;
+            num_failed += job->results[i].error != ZIP_TEST_OK;
+        }
+    }
+    pthread_mutex_lock(&job->mutex);
+    job->num_failed += num_failed;
+    pthread_mutex_unlock(&job->mutex);
+    return NULL;
+}
+
+// qsort has no context argument, sort offsets with their entry indices instead
+struct zip_test_key {
+    uint64_t offset;
+    size_t index;
+};
+
+static int zip_test_compare(const void *a, const void *b) {
+    uint64_t x = ((const struct zip_test_key *)a)->offset, y = ((const struct zip_test_key *)b)->offset;
+    return (x > y) - (x < y);
+}
+
+long zip_test(FILE *stream, const struct zip_table *table, struct zip_test_result *results, int num_threads,
+              const struct zip_allocator *allocator) {
+    struct stat st;
+    if (fstat(fileno(stream), &st))
+        return -1;
+    if (num_threads < 1)
+        num_threads = 1;
+
+    size_t n = table->num_entries;
+    allocator = zip_allocator_or_default(allocator);
+    struct zip_test_key *keys = (struct zip_test_key *)zip_malloc(allocator, (n ? n : 1) * sizeof(*keys));
+    size_t *order = (size_t *)zip_malloc(allocator, (2 * n + 1) * sizeof(*order));
+    struct zip_test_worker *workers = (struct zip_test_worker *)zip_malloc(allocator, num_threads * sizeof(*workers));
+    uint8_t *buffers = (uint8_t *)zip_malloc(allocator, (size_t)num_threads * ZIP_TEST_BUFFER_SIZE);
+    pthread_t *threads = (pthread_t *)zip_malloc(allocator, num_threads * sizeof(*threads));
+    if (!(keys && order && workers && buffers && threads)) {
+        zip_free(allocator, keys);
+        zip_free(allocator, order);
+        zip_free(allocator, workers);
+        zip_free(allocator, buffers);
+        zip_free(allocator, threads);
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        keys[i] = (struct zip_test_key){table->local_header_offset[i], i};
+    qsort(keys, n, sizeof(*keys), zip_test_compare);
+
+    // consecutive entries are batched until they cover enough compressed data
+    struct zip_test_job job = {table, results, order, order + n, 0, 0, PTHREAD_MUTEX_INITIALIZER, workers, 0};
+    size_t *batches = order + n;
+    uint64_t batch_size = 0;
+    for (size_t k = 0; k < n; ++k) {
+        order[k] = keys[k].index;
+        if (k == 0 || batch_size >= ZIP_TEST_BATCH_SIZE) {
+            batches[job.num_batches++] = k;
+            batch_size = 0;
+        }
+        batch_size += table->compressed_size[keys[k].index];
+    }
+    batches[job.num_batches] = n;
+    zip_free(allocator, keys);
+
+    for (int t = 0; t < num_threads; ++t) {
+        workers[t].reader = (struct zip_test_reader){fileno(stream), st.st_size, 0, 0, 0, buffers + (size_t)t * ZIP_TEST_BUFFER_SIZE};
+        workers[t].job = &job;
+    }
+
+    // calling thread is the first worker
+    int num_started = 1;
+    for (; num_started < num_threads; ++num_started)
+        if (pthread_create(threads + num_started, NULL, zip_test_run, workers + num_started))
+            break;
+    zip_test_run(workers);
+    for (int t = 1; t < num_started; ++t)
+        pthread_join(threads[t], NULL);
+
+    pthread_mutex_destroy(&job.mutex);
+    zip_free(allocator, threads);
+    zip_free(allocator, buffers);
+    zip_free(allocator, workers);
+    zip_free(allocator, order);
+    return job.num_failed;
 }
 
 int zip_store(FILE *stream, const char *filename, const void *data, size_t size) {
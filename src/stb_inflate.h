@@ -1,12 +1,10 @@
-#include <stdint.h>
-#include <string.h>
+#ifndef STB_INFLATE_H
+#define STB_INFLATE_H
 
-#ifndef NDEBUG
+#include <stdint.h>
 #include <stdio.h>
-#define STBI_ZERROR(x) fprintf(stderr, "%s:%d: error: %s\n", __FILE__, __LINE__, x), 0
-#else
-#define STBI_ZERROR(x) 0
-#endif
+#include <string.h>
+#include <time.h>
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
 #define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
@@ -23,6 +21,77 @@ struct stbi__zhuffman {
    uint16_t value[288];
 };
 
+// opt-in decoder counters, filled when stream->stats is set
+struct stbi__stats {
+   size_t blocks[3]; // stored, fixed, dynamic
+   size_t huffman_builds;
+   size_t decodes;
+   size_t slow_decodes; // decodes not resolved by fast table
+   size_t literals;
+   size_t matches;
+   uint64_t match_length;
+   uint64_t match_distance;
+   size_t refills;
+   uint64_t refill_bytes;
+   size_t flushes;
+   uint64_t flush_bytes;
+   double io_seconds;
+   double total_seconds;
+};
+
+// zlib-from-memory implementation for PNG reading
+//    because PNG allows splitting the zlib stream arbitrarily,
+//    and it's annoying structurally to have PNG call ZLIB call PNG,
+//    we require PNG read all the IDATs and combine them into a single
+//    memory buffer
+
+typedef struct stbi__stream
+{
+    const uint8_t *start_in;
+    const uint8_t *next_in;
+    const uint8_t *end_in;
+
+    uint8_t *start_out;
+    uint8_t *next_out;
+    uint8_t *end_out;
+
+    void *cookie_in;
+    void *cookie_out;
+
+    size_t total_in;
+    size_t total_out;
+
+    int (*refill)(struct stbi__stream *);
+    int (*flush)(struct stbi__stream *);
+
+    struct stbi__stats *stats;
+
+   int num_bits;
+   uint32_t code_buffer;
+
+   struct stbi__zhuffman z_length, z_distance;
+} stbi__zbuf;
+
+int refill_zeros(struct stbi__stream *stream);
+int refill_stdio(struct stbi__stream *stream);
+int flush_stdio(struct stbi__stream *stream);
+int stb_inflate(struct stbi__stream *a);
+
+#endif // STB_INFLATE_H
+
+#ifdef STB_INFLATE_IMPLEMENTATION
+#ifndef STB_INFLATE_IMPLEMENTED
+#define STB_INFLATE_IMPLEMENTED
+
+#include <pthread.h>
+
+#ifndef NDEBUG
+#include <stdio.h>
+#define STBI_ZERROR(x) fprintf(stderr, "%s:%d: error: %s\n", __FILE__, __LINE__, x), 0
+#else
+#define STBI_ZERROR(x) 0
+#endif
+
 static inline int stbi__bitreverse16(int n)
 {
   n = ((n & 0xAAAA) >>  1) | ((n & 0x5555) << 1);
@@ -39,7 +108,7 @@ static inline int stbi__bit_reverse(int v, int bits)
    return stbi__bitreverse16(v) >> (16-bits);
 }
 
-static int stbi__zbuild_huffman(struct stbi__zhuffman *z, uint8_t *sizelist, int num)
+static int stbi__zbuild_huffman(struct stbi__zhuffman *z, const uint8_t *sizelist, int num)
 {
    int i,k=0;
    int code, next_code[16], sizes[17];
@@ -86,36 +155,12 @@ static int stbi__zbuild_huffman(struct stbi__zhuffman *z, uint8_t *sizelist, int
    return 1;
 }
 
-// zlib-from-memory implementation for PNG reading
-//    because PNG allows splitting the zlib stream arbitrarily,
-//    and it's annoying structurally to have PNG call ZLIB call PNG,
-//    we require PNG read all the IDATs and combine them into a single
-//    memory buffer
-
-typedef struct stbi__stream
+static inline double stbi__now(void)
 {
-    const uint8_t *start_in;
-    const uint8_t *next_in;
-    const uint8_t *end_in;
-
-    uint8_t *start_out;
-    uint8_t *next_out;
-    uint8_t *end_out;
-
-    void *cookie_in;
-    void *cookie_out;
-
-    size_t total_in;
-    size_t total_out;
-
-    int (*refill)(struct stbi__stream *);
-    int (*flush)(struct stbi__stream *);
-
-   int num_bits;
-   uint32_t code_buffer;
-
-   struct stbi__zhuffman z_length, z_distance;
-} stbi__zbuf;
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
 int refill_zeros(struct stbi__stream *stream) {
     static const uint8_t zeros[64] = {0};
@@ -135,18 +180,43 @@ int refill_stdio(struct stbi__stream *stream) {
 }
 
 int flush_stdio(struct stbi__stream *stream) {
-    size_t n = fwrite(stream->start_out, 1, stream->next_out - stream->start_out, (FILE *)stream->cookie_out);
-    if (n) {
+    size_t size = stream->next_out - stream->start_out;
+    if (fwrite(stream->start_out, 1, size, (FILE *)stream->cookie_out) == size) {
         stream->next_out = stream->start_out;
         return 0;
     }
     return -1;
 }
 
+static int stbi__refill(struct stbi__stream *stream)
+{
+    if (!stream->stats)
+        return stream->refill(stream);
+    double t = stbi__now();
+    int ret = stream->refill(stream);
+    stream->stats->io_seconds += stbi__now() - t;
+    stream->stats->refills++;
+    stream->stats->refill_bytes += stream->end_in - stream->next_in;
+    return ret;
+}
+
+static int stbi__flush(struct stbi__stream *stream)
+{
+    if (!stream->stats)
+        return stream->flush(stream);
+    size_t n = stream->next_out - stream->start_out;
+    double t = stbi__now();
+    int ret = stream->flush(stream);
+    stream->stats->io_seconds += stbi__now() - t;
+    stream->stats->flushes++;
+    stream->stats->flush_bytes += n;
+    return ret;
+}
+
 static inline uint8_t stbi__zget8(struct stbi__stream *stream)
 {
     if (stream->next_in == stream->end_in)
-        stream->refill(stream);
+        stbi__refill(stream);
     return *stream->next_in++;
 }
 
@@ -178,6 +248,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, struct stbi__zhuffman *
       if (k < z->maxcode[s])
          break;
    if (s == 16) return -1; // invalid code!
+   if (a->stats) a->stats->slow_decodes++;
    // code size is s, so:
    b = (k >> (16-s)) - z->firstcode[s] + z->firstsymbol[s];
    a->code_buffer >>= s;
@@ -213,7 +284,23 @@ static int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
 static int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
-static int stbi__parse_huffman_block(stbi__zbuf *a)
+#if defined(__GNUC__) || defined(__clang__)
+#define STBI__FORCEINLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define STBI__FORCEINLINE static __forceinline
+#else
+#define STBI__FORCEINLINE static inline
+#endif
+
+struct stbi__block_counts {
+   size_t literals;
+   size_t matches;
+   uint64_t length;
+   uint64_t distance;
+};
+
+// inlined twice, with counts NULL the counting folds away and the plain copy has the original inner loop
+STBI__FORCEINLINE int stbi__parse_huffman_block_counted(stbi__zbuf *a, struct stbi__block_counts *counts)
 {
    uint8_t *zout = a->next_out;
    for(;;) {
@@ -222,11 +309,12 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          if (z < 0) return STBI_ZERROR("bad huffman code"); // error in huffman codes
          if (zout == a->end_out) {
              a->next_out = zout;
-             if (a->flush(a))
+             if (stbi__flush(a))
                  return 0;
              zout = a->next_out;
          }
          *zout++ = (char) z;
+         if (counts) ++counts->literals;
          //a->window[a->total_out++ % (1 << 15)] = (char)z;
          //if (a->total_out % (1 << 15) == 0)
          //    fwrite(a->window, sizeof(a->window), 1, stdout);
@@ -244,6 +332,11 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          if (z < 0) return STBI_ZERROR("bad huffman code");
          dist = stbi__zdist_base[z];
          if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
+         if (counts) {
+            ++counts->matches;
+            counts->length += len;
+            counts->distance += dist;
+         }
          //if (zout - a->zout_start < dist) return STBI_ZERROR("bad dist");
          //if (zout + len > a->zout_end) {
          //   if (!stbi__zexpand(a, zout, len)) return 0;
@@ -265,7 +358,8 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
                     src = a->start_out;
                 if (zout == a->end_out){
                     a->next_out = zout;
-                    a->flush(a);
+                    if (stbi__flush(a))
+                        return 0;
                     zout = a->next_out;
                 }
                 *zout++ = *src++;
@@ -284,6 +378,30 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
    }
 }
 
+static int stbi__parse_huffman_block_plain(stbi__zbuf *a)
+{
+   return stbi__parse_huffman_block_counted(a, NULL);
+}
+
+// counters are kept in locals and added once per block to stay out of the inner loop
+static int stbi__parse_huffman_block_stats(stbi__zbuf *a)
+{
+   struct stbi__block_counts counts = {0, 0, 0, 0};
+   int ret = stbi__parse_huffman_block_counted(a, &counts);
+   // every literal and end of block is one decode, every match is two
+   a->stats->decodes += counts.literals + 2 * counts.matches + ret;
+   a->stats->literals += counts.literals;
+   a->stats->matches += counts.matches;
+   a->stats->match_length += counts.length;
+   a->stats->match_distance += counts.distance;
+   return ret;
+}
+
+static int stbi__parse_huffman_block(stbi__zbuf *a)
+{
+   return a->stats ? stbi__parse_huffman_block_stats(a) : stbi__parse_huffman_block_plain(a);
+}
+
 static int stbi__compute_huffman_codes(stbi__zbuf *a)
 {
    static uint8_t length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
@@ -307,9 +425,12 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
    while (n < hlit + hdist) {
       int c = stbi__zhuffman_decode(a, &z_codelength);
       if (c < 0 || c >= 19) return STBI_ZERROR("bad codelengths");
+      if (a->stats) a->stats->decodes++;
       if (c < 16)
          lencodes[n++] = (uint8_t) c;
       else if (c == 16) {
+         // repeat of previous length needs one
+         if (n == 0) return STBI_ZERROR("bad codelengths");
          c = stbi__zreceive(a,2)+3;
          memset(lencodes+n, lencodes[n-1], c);
          n += c;
@@ -353,8 +474,8 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
        size_t avail_out = a->end_out - a->next_out;
        while (avail_out-- && len--)
            *a->next_out++ = stbi__zget8(a);
-       if (len > 0)
-           a->flush(a);
+       if (len > 0 && stbi__flush(a))
+           return 0;
    } while (len > 0);
 
    //while (len--) {
@@ -370,20 +491,27 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
    return 1;
 }
 
-// @TODO: should statically initialize these for optimal thread safety
-static uint8_t stbi__zdefault_length[288], stbi__zdefault_distance[32];
+// fixed huffman tables, built once from the spec code lengths so fixed blocks cost a copy
+// and concurrent decoders never see a half built table
+static struct stbi__zhuffman stbi__zdefault_length_table, stbi__zdefault_distance_table;
+static pthread_once_t stbi__zdefault_once = PTHREAD_ONCE_INIT;
+
 static void stbi__init_zdefaults(void)
 {
+   uint8_t length[288], distance[32];
    int i;   // use <= to match clearly with spec
-   for (i=0; i <= 143; ++i)     stbi__zdefault_length[i]   = 8;
-   for (   ; i <= 255; ++i)     stbi__zdefault_length[i]   = 9;
-   for (   ; i <= 279; ++i)     stbi__zdefault_length[i]   = 7;
-   for (   ; i <= 287; ++i)     stbi__zdefault_length[i]   = 8;
+   for (i=0; i <= 143; ++i)     length[i]   = 8;
+   for (   ; i <= 255; ++i)     length[i]   = 9;
+   for (   ; i <= 279; ++i)     length[i]   = 7;
+   for (   ; i <= 287; ++i)     length[i]   = 8;
+
+   for (i=0; i <=  31; ++i)     distance[i] = 5;
 
-   for (i=0; i <=  31; ++i)     stbi__zdefault_distance[i] = 5;
+   stbi__zbuild_huffman(&stbi__zdefault_length_table  , length  , 288);
+   stbi__zbuild_huffman(&stbi__zdefault_distance_table, distance,  32);
 }
 
-int stb_inflate(struct stbi__stream *a)
+static int stbi__inflate(struct stbi__stream *a)
 {
    int final, type;
    a->num_bits = 0;
@@ -392,6 +520,7 @@ int stb_inflate(struct stbi__stream *a)
    do {
       final = stbi__zreceive(a,1);
       type = stbi__zreceive(a,2);
+      if (a->stats && type < 3) a->stats->blocks[type]++;
       if (type == 0) {
          if (!stbi__parse_uncompressed_block(a)) return 0;
       } else if (type == 3) {
@@ -399,15 +528,29 @@ int stb_inflate(struct stbi__stream *a)
       } else {
          if (type == 1) {
             // use fixed code lengths
-            if (!stbi__zdefault_distance[31]) stbi__init_zdefaults();
-            if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , 288)) return 0;
-            if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+            pthread_once(&stbi__zdefault_once, stbi__init_zdefaults);
+            a->z_length = stbi__zdefault_length_table;
+            a->z_distance = stbi__zdefault_distance_table;
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
+         // code length, literal/length and distance tables of dynamic blocks, fixed tables are built once per process
+         if (a->stats && type == 2) a->stats->huffman_builds += 3;
          if (!stbi__parse_huffman_block(a)) return 0;
       }
    } while (!final);
-   a->flush(a);
-   return 1;
+   return !stbi__flush(a);
 }
+
+int stb_inflate(struct stbi__stream *a)
+{
+   if (!a->stats)
+      return stbi__inflate(a);
+   double t = stbi__now();
+   int ret = stbi__inflate(a);
+   a->stats->total_seconds += stbi__now() - t;
+   return ret;
+}
+
+#endif // STB_INFLATE_IMPLEMENTED
+#endif // STB_INFLATE_IMPLEMENTATION
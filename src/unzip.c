@@ -7,7 +7,114 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <zlib.h>
+#include <unistd.h>
+
+static int print_name(const struct zip_entry *e, void *user) {
+    printf("%s\n", e->filename);
+    return 0;
+}
+
+static int print_verbose(const struct zip_entry *e, void *user) {
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y %b %d %H:%M", localtime(&e->mtime));
+    printf("%10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %s %s\n",
+           e->local_header_offset, e->compressed_size, e->uncompressed_size, buf, e->filename);
+    return 0;
+}
+
+static int write_stdout(const void *data, size_t size, void *user) {
+    return fwrite(data, size, 1, (FILE *)user) == 0;
+}
+
+static struct zip_stats reader_stats;
+static struct stbi__stats inflate_stats;
+
+static void print_stats(void) {
+    const struct zip_stats *r = &reader_stats;
+    const struct stbi__stats *s = &inflate_stats;
+    fprintf(stderr, "reader: %zu seeks, %zu reads, %" PRIu64 " bytes, %.6f s io\n",
+            r->seeks, r->reads, r->read_bytes, r->io_seconds);
+    fprintf(stderr, "inflate: blocks %zu stored, %zu fixed, %zu dynamic, %zu huffman table builds\n",
+            s->blocks[0], s->blocks[1], s->blocks[2], s->huffman_builds);
+    fprintf(stderr, "inflate: %zu decodes, %zu fast table, %zu slow path\n",
+            s->decodes, s->decodes - s->slow_decodes, s->slow_decodes);
+    fprintf(stderr, "inflate: %zu literals, %zu matches, %.1f average length, %.1f average distance\n",
+            s->literals, s->matches,
+            s->matches ? (double)s->match_length / s->matches : 0.0,
+            s->matches ? (double)s->match_distance / s->matches : 0.0);
+    fprintf(stderr, "inflate: %zu refills, %" PRIu64 " bytes, %zu flushes, %" PRIu64 " bytes\n",
+            s->refills, s->refill_bytes, s->flushes, s->flush_bytes);
+    fprintf(stderr, "inflate: %.6f s total, %.6f s io, %.6f s decode\n",
+            s->total_seconds, s->io_seconds, s->total_seconds - s->io_seconds);
+}
+
+// backend of the last zip_extract from counters it moved, stb always counts a block, zlib a refill, stored data neither
+static const char *extract_backend(const struct stbi__stats *before) {
+    const struct stbi__stats *s = &inflate_stats;
+    if (s->blocks[0] + s->blocks[1] + s->blocks[2] != before->blocks[0] + before->blocks[1] + before->blocks[2])
+        return "stb";
+    return s->refills != before->refills ? "zlib" : "stored";
+}
+
+static const char *test_errors[] = {"ok", "read error", "local header mismatch", "unsupported compression method",
+                                    "bad deflate stream", "size mismatch", "crc mismatch"};
+
+#define NUM_SLOWEST 5
+
+// verify all entries on every core, print failures, throughput and slowest entries
+static int test_archive(FILE *fp, const char *path) {
+    struct zip_table table;
+    // malformed central directory doesn't set errno, perror would print whatever came before
+    if (zip_read_table(&table, fp, NULL)) {
+        fprintf(stderr, "%s: can't read central directory\n", path);
+        return 1;
+    }
+    struct zip_test_result *results = (struct zip_test_result *)malloc((table.num_entries ? table.num_entries : 1) * sizeof(*results));
+    if (!results) {
+        perror(path);
+        zip_table_free(&table);
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long failed = zip_test(fp, &table, results, sysconf(_SC_NPROCESSORS_ONLN), NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (failed < 0) {
+        perror(path);
+        free(results);
+        zip_table_free(&table);
+        return 1;
+    }
+
+    uint64_t compressed = 0, uncompressed = 0;
+    size_t slowest[NUM_SLOWEST], num_slowest = 0;
+    for (size_t i = 0; i < table.num_entries; ++i) {
+        if (results[i].error != ZIP_TEST_OK)
+            printf("%s: %s\n", zip_table_filename(&table, i), test_errors[results[i].error]);
+        compressed += table.compressed_size[i];
+        uncompressed += table.uncompressed_size[i];
+
+        // keep slowest sorted, insertion is fine for a handful
+        size_t k = num_slowest < NUM_SLOWEST ? num_slowest++ : NUM_SLOWEST;
+        for (; k > 0 && results[slowest[k - 1]].seconds < results[i].seconds; --k)
+            if (k < NUM_SLOWEST)
+                slowest[k] = slowest[k - 1];
+        if (k < NUM_SLOWEST)
+            slowest[k] = i;
+    }
+
+    double seconds = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("%zu entries, %ld failed, %" PRIu64 " bytes compressed, %" PRIu64 " bytes uncompressed, %.3f s, %.1f MB/s\n",
+           table.num_entries, failed, compressed, uncompressed, seconds, seconds > 0 ? uncompressed / seconds / 1e6 : 0.0);
+    for (size_t k = 0; k < num_slowest; ++k)
+        printf("%10.6f s %10" PRIu64 " %s\n", results[slowest[k]].seconds, table.uncompressed_size[slowest[k]],
+               zip_table_filename(&table, slowest[k]));
+
+    free(results);
+    zip_table_free(&table);
+    return failed != 0;
+}
 
 int main(int argc, char **argv) {
 #if 0
@@ -26,8 +133,18 @@ int main(int argc, char **argv) {
     dump(u, ZIP64_END_OF_CENTRAL_DIR_LOCATOR(ZIP_POS_SIZE));
 #endif
 
+    // -s goes before mode, keep program name in argv[0]
+    int stats = argc > 1 && !strcmp("-s", argv[1]);
+    if (stats) {
+        argv[1] = argv[0];
+        ++argv;
+        --argc;
+        zip_set_stats(&reader_stats);
+        zip_set_inflate_stats(&inflate_stats);
+    }
+
     if (argc < 3) {
-        fprintf(stderr, "usage: %s [-lvx] file [file ...]\n", argv[0]);
+        fprintf(stderr, "usage: %s [-s] [-lvxzt] file [file ...]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -40,6 +157,8 @@ int main(int argc, char **argv) {
         mode = 'x';
     else if (!strcmp("-z", argv[1]))
         mode = 'z';
+    else if (!strcmp("-t", argv[1]))
+        mode = 't';
     else {
         fprintf(stderr, "%s: illegal option -- %s\n", argv[0], argv[1]);
         return EXIT_FAILURE;
@@ -51,135 +170,52 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
+    // listing streams entries straight from the central directory
+    if (mode == 'l' || mode == 'v') {
+        // empty archive lists nothing, a bad record ends the listing with an error after what was printed
+        if (zip_iterate(fp, mode == 'l' ? print_name : print_verbose, NULL, NULL) == (size_t)-1) {
+            fprintf(stderr, "%s: can't read central directory\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        fclose(fp);
+        if (stats)
+            print_stats();
+        return 0;
+    }
+
+    if (mode == 't') {
+        int failed = test_archive(fp, argv[2]);
+        fclose(fp);
+        if (stats)
+            print_stats();
+        return failed ? EXIT_FAILURE : 0;
+    }
+
     struct zip_entry *entries = NULL;
     size_t num_entries = zip_read(&entries, fp);
+    enum zip_codec codec;
     if (num_entries == 0 || entries == NULL) {
         perror(argv[2]);
         return EXIT_FAILURE;
     }
 
     switch (mode) {
-    case 'l':
-        for (size_t i = 0; i < num_entries; ++i) {
-            printf("%s\n", entries[i].filename);
-        }
-        break;
-    case 'v':
-        for (size_t i = 0; i < num_entries; ++i) {
-            struct zip_entry *e = entries + i;
-            char buf[32];
-            strftime(buf, sizeof(buf), "%Y %b %d %H:%M", localtime(&e->mtime));
-            printf("%10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %s %s\n",
-                   e->local_header_offset, e->compressed_size, e->uncompressed_size, buf, e->filename);
-        }
-        break;
     case 'x':
     case 'z':
+        // -s measures the same backends a plain run picks, huffman counters stay zero for zlib entries
+        codec = mode == 'z' ? ZIP_CODEC_ZLIB : ZIP_CODEC_AUTO;
         for (int argi = 3; argi < argc; ++argi) {
             for (size_t i = 0; i < num_entries; ++i) {
                 struct zip_entry *e = entries + i;
                 if (!strcmp(argv[argi], e->filename)) {
-                    if (e->uncompressed_size == 0)
-                        continue;
-                    if (zip_seek(fp, e)) {
+                    // stored and deflated entries alike are streamed, nothing is buffered whole
+                    struct stbi__stats before = inflate_stats;
+                    if (zip_extract(fp, e, write_stdout, stdout, codec, NULL)) {
                         perror(argv[argi]);
                         return EXIT_FAILURE;
                     }
-                    if (e->compressed_size == e->uncompressed_size) {
-                        void *buf = malloc(e->compressed_size);
-                        if (!buf) {
-                            perror(argv[argi]);
-                            return EXIT_FAILURE;
-                        }
-                        if (fread(buf, e->compressed_size, 1, fp) == 0) {
-                            perror(argv[argi]);
-                            return EXIT_FAILURE;
-                        }
-#if 1
-                        int zip_store(FILE *stream, const char *filename, const void *data, size_t size);
-                        int zip_finalize(FILE *stream);
-                        FILE *fp = fopen("test.zip", "w+b");
-                        if (fp) {
-                            zip_store(fp, e->filename, buf, e->compressed_size);
-                            zip_store(fp, "foo", "hello world\n", 12);
-                            zip_finalize(fp);
-                            fclose(fp);
-                        }
-#endif
-
-                        if (fwrite(buf, e->compressed_size, 1, stdout) == 0) {
-                            perror(argv[argi]);
-                            return EXIT_FAILURE;
-                        }
-                        free(buf);
-                    } else {
-#if 0
-                        void *buf = malloc(e->compressed_size);
-                        void *out = malloc(e->uncompressed_size);
-                        if (fread(buf, e->compressed_size, 1, fp) == 0) {
-                            perror(argv[argi]);
-                            return EXIT_FAILURE;
-                        }
-
-                        if (mode == 'z') {
-                            z_stream stream = {
-                                .next_in = buf,
-                                .avail_in = e->compressed_size,
-                                .next_out = out,
-                                .avail_out = e->uncompressed_size,
-                            };
-                            inflateInit2(&stream, -MAX_WBITS);
-                            while (stream.avail_out) {
-                                int ret = inflate(&stream, Z_NO_FLUSH);
-                                if (ret == Z_STREAM_END)
-                                    break;
-                                if (ret != Z_OK) {
-                                    fprintf(stderr, "error: uncompress: %d\n", ret);
-                                    break;
-                                }
-                            }
-                            inflateEnd(&stream);
-                        } else {
-                            struct stbi__stream stream;
-                            memset(&stream, 0, sizeof(stream));
-
-                            stream.start_in = stream.next_in = buf;
-                            stream.end_in = stream.start_in + e->compressed_size;
-
-                            if (!stb_inflate(&stream)) {
-                                perror(argv[argi]);
-                                return EXIT_FAILURE;
-                            }
-                        }
-
-                        if (mode == 'z' && fwrite(out, e->uncompressed_size, 1, stdout) == 0) {
-                            perror(argv[argi]);
-                            return EXIT_FAILURE;
-                        }
-                        free(buf);
-                        free(out);
-#else
-                        struct stbi__stream stream;
-                        memset(&stream, 0, sizeof(stream));
-
-                        uint8_t buffer[BUFSIZ];
-                        stream.start_in = buffer;
-                        stream.end_in = stream.next_in = buffer + sizeof(buffer);
-                        stream.cookie_in = fp;
-                        stream.refill = refill_stdio;
-
-                        uint8_t window[1 << 15];
-                        stream.start_out = stream.next_out = window;
-                        stream.end_out = window + sizeof(window);
-                        stream.cookie_out = stdout;
-                        stream.flush = flush_stdio;
-
-                        if (!stb_inflate(&stream)) {
-                            perror(argv[argi]);
-                            return EXIT_FAILURE;
-                        }
-#endif
-                    }
+                    if (stats)
+                        fprintf(stderr, "extract: %s: %s\n", e->filename, extract_backend(&before));
                 }
             }
         }
@@ -189,5 +225,8 @@ int main(int argc, char **argv) {
     free(entries);
     fclose(fp);
 
+    if (stats)
+        print_stats();
+
     return 0;
 }